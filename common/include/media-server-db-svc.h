@@ -53,6 +53,18 @@ typedef int (*DELETE_ALL_INVALID_ITMES_IN_STORAGE)(void*, int, char **);
 typedef int (*UPDATE_BEGIN)(char **);
 typedef int (*UPDATE_END)(char **);
 typedef int (*REFRESH_ITEM)(void*, const char *, int, const char*, char**);
+typedef int (*SET_FOLDER_ITEM_VALIDITY)(void*, const char*, int, int, char**);
+typedef int (*DELETE_ALL_INVALID_ITEMS_IN_FOLDER)(void*, const char*, char**);
+typedef int (*DELETE_ITEM_BEGIN)(void*, int, char **);
+typedef int (*DELETE_ITEM_END)(void*, char **);
+typedef int (*REFRESH_ITEM_BEGIN)(void*, int, char **);
+typedef int (*REFRESH_ITEM_END)(void*, char **);
+typedef int (*MOVE_FOLDER)(void*, const char*, int, const char*, int, char **);
+typedef int (*DELETE_FOLDER)(void*, const char*, char **);
+
+#define MS_PLUGIN_MAX 32 /*plugins are selected by bit mask*/
+#define MS_PLUGIN_BIT(index) (1u << (index))
+#define MS_PLUGIN_ALL 0xffffffffu
 
 int
 ms_load_functions(void);
@@ -66,15 +78,34 @@ ms_connect_db(void ***handle);
 int
 ms_disconnect_db(void ***handle);
 
+/*file missing in DB is inserted in bundle, it is in work until ms_register_end()*/
 int
 ms_validate_item(void **handle, char *path);
 
+/*mimetype has to hold 255 bytes, drm is set if it is not NULL*/
 int
-ms_register_file(void **handle, const char *path, GAsyncQueue* queue);
+ms_get_item_mime(const char *path, char *mimetype, bool *drm);
+
+/*same as ms_validate_item with the mime type which ms_get_item_mime got*/
+int
+ms_validate_item_with_mime(void **handle, char *path, const char *mimetype, bool drm);
+
+int
+ms_register_file(void **handle, const char *path, bool wait);
+
+int
+ms_register_file_batch(void **handle, const char *path);
+
+/*file of full scan, it is in work until ms_register_end()*/
+int
+ms_register_file_batch_with_mime(void **handle, const char *path, const char *mimetype, bool drm);
 
 int
 ms_insert_item_batch(void **handle, const char *path);
 
+int
+ms_insert_item_batch_with_mime(void **handle, const char *path, const char *mimetype, bool drm);
+
 int
 ms_insert_item(void **handle, const char *path);
 
@@ -88,6 +119,14 @@ ms_move_item(void **handle,
 		     	const char *src_file_full_path,
 		     	const char *dest_file_full_path);
 
+int
+ms_move_item_by_plugins(void **handle,
+			unsigned int plugins,
+			ms_storage_type_t src_store_type,
+			ms_storage_type_t dest_store_type,
+			const char *src_file_full_path,
+			const char *dest_file_full_path);
+
 bool
 ms_delete_all_items(void **handle, ms_storage_type_t store_type);
 
@@ -103,6 +142,32 @@ ms_refresh_item(void **handle, const char *path);
 int
 ms_check_exist(void **handle, const char *path);
 
+bool
+ms_support_folder_validity(void);
+
+int
+ms_invalidate_folder_items(void **handle, const char *path);
+
+int
+ms_delete_invalid_folder_items(void **handle, const char *path);
+
+bool
+ms_support_move_folder(void);
+
+int
+ms_move_folder(void **handle,
+			ms_storage_type_t src_store_type,
+			ms_storage_type_t dest_store_type,
+			const char *src_folder_full_path,
+			const char *dest_folder_full_path,
+			unsigned int *rest_plugins);
+
+bool
+ms_support_delete_folder(void);
+
+int
+ms_delete_folder(void **handle, const char *path);
+
 /****************************************************************************************************
 FOR BULK COMMIT
 *****************************************************************************************************/
@@ -125,4 +190,23 @@ ms_validate_start(void **handle);
 void
 ms_validate_end(void **handle);
 
+void
+ms_delete_start(void **handle);
+
+void
+ms_delete_end(void **handle);
+
+void
+ms_refresh_start(void **handle);
+
+void
+ms_refresh_end(void **handle);
+
+/*insert, move, delete and refresh in one bundle*/
+void
+ms_batch_start(void **handle);
+
+void
+ms_batch_end(void **handle);
+
 #endif /*_MEDIA_SERVER_DB_SVC_H_*/
\ No newline at end of file
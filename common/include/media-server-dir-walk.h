@@ -0,0 +1,71 @@
+/*
+ *  Media Server
+ *
+ * Copyright (c) 2000 - 2011 Samsung Electronics Co., Ltd. All rights reserved.
+ *
+ * Contact: Yong Yeon Kim <yy9875.kim@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * This file defines api utilities of contents manager engines.
+ *
+ * @file		media-server-dir-walk.h
+ * @author	Yong Yeon Kim(yy9875.kim@samsung.com)
+ * @version	1.0
+ * @brief
+ */
+#ifndef _MEDIA_SERVER_DIR_WALK_H_
+#define _MEDIA_SERVER_DIR_WALK_H_
+
+#include "media-server-global.h"
+
+typedef enum {
+	MS_WALK_CONTINUE,
+	MS_WALK_SKIP,	/*directory is not read*/
+	MS_WALK_STOP,	/*walk ends at once*/
+} ms_walk_result_t;
+
+typedef struct ms_dir_entry {
+	const char *name;
+	ino_t ino;
+	unsigned char type;	/*DT_* of the entry*/
+} ms_dir_entry;
+
+/*entries of one directory which are not directory, they are read by one getdents64 call*/
+typedef struct ms_walk_batch {
+	int dir_fd;	/*directory of the entries, for *at() calls*/
+	char *path;	/*path of the directory, name is joined only by ms_walk_entry_path()*/
+	int dir_len;
+	ms_dir_entry *entries;
+	int count;
+} ms_walk_batch;
+
+/*path is valid only during the call, watch or stamp of the directory is done here before it is read*/
+typedef ms_walk_result_t (*ms_walk_dir_cb)(const char *path, void *user_data);
+
+/*names of batch are valid only during the call*/
+typedef ms_walk_result_t (*ms_walk_file_cb)(ms_walk_batch *batch, void *user_data);
+
+/*depth first walk with an explicit stack, sub directories are opened relative to their parent. hidden entries are skipped*/
+int ms_walk_dir(const char *path, ms_walk_dir_cb dir_func, ms_walk_file_cb file_func, void *user_data);
+
+/*read only the directory of path, dir_func is called for each sub directory instead of entering it*/
+int ms_read_dir(const char *path, ms_walk_dir_cb dir_func, ms_walk_file_cb file_func, void *user_data);
+
+/*full path of an entry of batch, valid until next call or the callback returns*/
+const char *ms_walk_entry_path(ms_walk_batch *batch, int index);
+
+#endif /*_MEDIA_SERVER_DIR_WALK_H_*/
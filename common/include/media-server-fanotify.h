@@ -0,0 +1,48 @@
+/*
+ *  Media Server
+ *
+ * Copyright (c) 2000 - 2011 Samsung Electronics Co., Ltd. All rights reserved.
+ *
+ * Contact: Yong Yeon Kim <yy9875.kim@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * This file defines api utilities of contents manager engines.
+ *
+ * @file		media-server-fanotify.h
+ * @author	Yong Yeon Kim(yy9875.kim@samsung.com)
+ * @version	1.0
+ * @brief
+ */
+#ifndef _MEDIA_SERVER_FANOTIFY_H_
+#define _MEDIA_SERVER_FANOTIFY_H_
+
+#include "media-server-global.h"
+#include "media-server-types.h"
+
+/*return fd of new fanotify group of storage, -1 if kernel does not support directory entry events*/
+int ms_fanoti_init(ms_storage_type_t storage_type);
+
+/*forget file systems marked by the group of storage, the group is being closed*/
+void ms_fanoti_clear(ms_storage_type_t storage_type);
+
+/*watch whole file system which has path, events out of the storage are dropped*/
+int ms_fanoti_mark(ms_storage_type_t storage_type, int fd, const char *path);
+
+/*read fanotify events and translate them into inotify events*/
+int ms_fanoti_read(ms_storage_type_t storage_type, int fd, char *buffer, int size);
+
+#endif /*_MEDIA_SERVER_FANOTIFY_H_*/
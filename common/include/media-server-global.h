@@ -88,12 +88,15 @@
 
 /*This macro is used to save and check information of inserted memory card*/
 #define MS_MMC_INFO_KEY "db/private/mediaserver/mmc_info"
+#define MS_COALESCE_TIME_KEY "db/private/mediaserver/coalesce_time"
+#define MS_INOTI_SHARD_KEY "db/private/mediaserver/inotify_shard"
+#define MS_TOMBSTONE_TIME_KEY "db/private/mediaserver/tombstone_time"
+#define MS_SCAN_WORKER_KEY "db/private/mediaserver/scan_worker"
+#define MS_FANOTIFY_KEY "db/private/mediaserver/fanotify"
 
 
 /*Use for Poweroff sequence*/
 #define POWEROFF_NOTI_NAME "power_off_start" /*poeroff noti from system-server*/
-#define POWEROFF_DIR_PATH "/opt/media/_POWER_OFF" /*This path uses for stopping Inotify thread and Socket thread*/
-#define POWEROFF_DIR_NAME "_POWER_OFF" /*This path uses for stopping Inotify thread and Socket thread*/
 #define POWEROFF 10000 /*This number uses for stopping Scannig thread*/
 
 /**
@@ -31,32 +31,186 @@
 #define _MEDIA_SERVER_INOTIFY_INTERNAL_H_
 
 #include <sys/inotify.h>
+#include <glib.h>
+#include "media-server-global.h"
+#include "media-server-inotify.h"
 
 #define INOTI_EVENT_SIZE (sizeof(struct inotify_event))
 #define INOTI_BUF_LEN (1024*(INOTI_EVENT_SIZE+16))
 #define INOTI_FOLDER_COUNT_MAX 1024
 
-typedef struct ms_inoti_dir_data {
-	char *name;
-	int wd;
-	struct ms_inoti_dir_data *next;
-} ms_inoti_dir_data;
+#define MS_INOTI_EPOLL_EVENT_MAX 3 /*instance, control and timer*/
+
+/*wd is unique only in its inotify instance, registry keeps wd with index of the instance*/
+#define MS_INOTI_WD_KEY(storage, wd) ((wd) * MS_INOTI_STORAGE_NUM + (storage))
+
+typedef struct ms_inoti_watch_info {
+	const char *name;	/*interned name of directory*/
+	int wd;	/*-1 : this node is only a part of watched path*/
+	guint scan_epoch;	/*epoch of the scan which has not read this directory yet, 0 : none*/
+	struct ms_inoti_watch_info *parent;
+	struct ms_inoti_watch_info *first_child;
+	struct ms_inoti_watch_info *prev_sibling;
+	struct ms_inoti_watch_info *next_sibling;
+} ms_inoti_watch_info;
+
+/*called with watch registry locked, must not call registry functions*/
+typedef void (*ms_inoti_watch_cb)(const char *path, int wd, void *user_data);
 
 typedef struct ms_create_file_info {
 	char *name;
 	int wd;
-	struct ms_create_file_info *previous;
-	struct ms_create_file_info *next;
+	gint64 time;	/*monotonic time of creating*/
+	GList *link;	/*link in queue of aging*/
 } ms_create_file_info;
 
-int _ms_inoti_add_create_file_list(int wd, char *name);
+typedef enum {
+	MS_INOTI_ACTION_INSERT,
+	MS_INOTI_ACTION_REFRESH,
+	MS_INOTI_ACTION_MOVE,
+	MS_INOTI_ACTION_DELETE,
+} ms_inoti_action_t;
+
+typedef struct ms_coalesce_info {
+	char *path;	/*path of the file after all events*/
+	char *path_from;	/*MS_INOTI_ACTION_MOVE : original path*/
+	ms_inoti_action_t action;	/*net action of all events*/
+	bool refresh;	/*MS_INOTI_ACTION_MOVE : file is modified after moving*/
+	bool tombstone;	/*node is in tombstone queue*/
+	gint64 deadline;	/*monotonic time of running action*/
+	GList *link;	/*link in queue of deadline*/
+} ms_coalesce_info;
+
+typedef struct ms_active_dir_info {
+	int wd;
+	time_t first;	/*time of the first event in the burst*/
+	time_t last;	/*time of the last event in the burst*/
+	int count;	/*the number of events in the second of last*/
+	bool hot;	/*flooded : events are dropped and directory is rescanned later*/
+} ms_active_dir_info;
+
+typedef struct ms_move_file_info {
+	char *path;	/*full path of IN_MOVED_FROM*/
+	int wd;	/*directory of IN_MOVED_FROM*/
+	uint32_t cookie;
+	bool is_dir;
+	gint64 time;	/*monotonic time of IN_MOVED_FROM*/
+	GList *link;	/*link in queue of expiry*/
+} ms_move_file_info;
+
+typedef enum {
+	MS_INOTI_JOB_CREATE,	/*IN_CREATE of file*/
+	MS_INOTI_JOB_CLOSE_WRITE,
+	MS_INOTI_JOB_INSERT,	/*file appears without IN_CREATE*/
+	MS_INOTI_JOB_DELETE,
+	MS_INOTI_JOB_MOVE,
+	MS_INOTI_JOB_SCAN_DIR,	/*directory on path is created or moved in*/
+	MS_INOTI_JOB_FENCE,	/*run all waiting actions and report*/
+	MS_INOTI_JOB_CLEAR,	/*drop all waiting actions and report*/
+	MS_INOTI_JOB_STOP,
+} ms_inoti_job_t;
+
+typedef struct ms_inoti_job_info {
+	ms_inoti_job_t type;
+	int wd;
+	char *name;	/*MS_INOTI_JOB_CREATE, MS_INOTI_JOB_CLOSE_WRITE : name in directory of wd*/
+	char *path;
+	char *path_from;	/*MS_INOTI_JOB_MOVE : original path*/
+} ms_inoti_job_info;
+
+struct ms_inoti_storage_info;
+
+/*file events of a directory are always handled by the same shard in order of arrival*/
+typedef struct ms_inoti_shard_info {
+	struct ms_inoti_storage_info *storage;
+	int index;
+	GThread *thread;
+	GAsyncQueue *queue;	/*ms_inoti_job_info from the event loop*/
+	GQueue *pending;	/*jobs collected by the event loop, pushed at once*/
+	void **handle;	/*DB handle of the shard*/
+
+	/*below are touched only by the shard thread*/
+	GHashTable *create_file_table;	/*(wd, name) -> ms_create_file_info*/
+	GQueue *create_file_queue;
+	GHashTable *create_file_drop_table;	/*(wd, name) of entries dropped before CLOSE_WRITE*/
+	GQueue *create_file_drop_queue;
+	GHashTable *coalesce_table;	/*path -> ms_coalesce_info*/
+	GQueue *coalesce_queue;
+	GQueue *tombstone_queue;	/*MS_INOTI_ACTION_DELETE waits longer than other actions*/
+	GHashTable *batch_path_table;
+	gint64 batch_start_time;	/*0 : bundle is not started*/
+} ms_inoti_shard_info;
+
+/*each storage has its own inotify instance and event loop*/
+typedef struct ms_inoti_storage_info {
+	ms_storage_type_t storage_type;
+	const char *root;	/*root path of storage*/
+	GMutex *mutex;	/*protects fd, close_fd and scan_epoch*/
+	int fd;	/*inotify instance, -1 : storage is detached*/
+	int close_fd;	/*instance of detached storage, the event loop closes it*/
+	int epoll_fd;	/*event loop waits instance, control and timer*/
+	int event_fd;	/*control message to event loop*/
+	int timer_fd;	/*nearest deadline of event loop*/
+	void **handle;	/*DB handle of the event loop, used for directory events*/
+	guint scan_epoch;	/*epoch of the running storage scan, 0 : no scan. protected by mutex*/
+
+	ms_inoti_shard_info *shards;	/*workers of file events*/
+	int shard_count;
+	GMutex *fence_mutex;
+	GCond *fence_cond;
+	int fence_count;	/*shards which have not finished fence yet*/
+
+	/*below are touched only by the event loop*/
+	GHashTable *move_file_table;	/*cookie -> ms_move_file_info*/
+	GQueue *move_file_queue;
+	GHashTable *active_dir_table;	/*wd -> ms_active_dir_info*/
+	int hot_dir_count;
+	gint64 poll_dir_time;	/*monotonic time of next polling, 0 : no polled directory. protected by poll dir mutex*/
+} ms_inoti_storage_info;
 
-int _ms_inoti_delete_create_file_list(ms_create_file_info *node);
+int _ms_inoti_watch_table_init(void);
 
-ms_create_file_info *_ms_inoti_find_create_file_list(int wd, char *name);
+bool _ms_inoti_watch_exist(const char *path);
+
+int _ms_inoti_get_watch_wd(const char *path);
+
+int _ms_inoti_insert_watch(int wd, const char *path);
+
+int _ms_inoti_delete_watch(const char *path);
+
+void _ms_inoti_delete_watch_recursive(const char *path);
+
+int _ms_inoti_rename_watch(const char *path_from, const char *path_to);
+
+void _ms_inoti_set_watch_epoch(const char *path, guint epoch, bool recursive);
+
+guint _ms_inoti_get_watch_epoch(int wd);
+
+void _ms_inoti_foreach_watch(const char *path, ms_inoti_watch_cb func, void *user_data);
+
+int _ms_inoti_get_watch_count(void);
+
+int _ms_inoti_get_watch_node_count(void);
+
+int _ms_inoti_create_file_init(ms_inoti_shard_info *shard);
+
+int _ms_inoti_add_create_file_list(ms_inoti_shard_info *shard, int wd, char *name);
+
+int _ms_inoti_delete_create_file_list(ms_inoti_shard_info *shard, ms_create_file_info *node);
+
+ms_create_file_info *_ms_inoti_find_create_file_list(ms_inoti_shard_info *shard, int wd, char *name);
+
+void _ms_inoti_clear_create_file_list(ms_inoti_shard_info *shard);
+
+/*true if the entry of (wd, name) was dropped before CLOSE_WRITE*/
+bool _ms_inoti_take_dropped_create_file(ms_inoti_shard_info *shard, int wd, char *name);
+
+int _ms_inoti_get_create_file_count(ms_inoti_shard_info *shard);
 
 bool _ms_inoti_full_path(int wd, char *name, char *path, int sizeofpath);
 
+bool _ms_inoti_get_watch_path(int wd, char *path, int sizeofpath);
+
 bool _ms_inoti_get_full_path(int wd, char *name, char *path, int sizeofpath);
 
 #endif /*_MEDIA_SERVER_INOTIFY_INTERNAL_H_*/
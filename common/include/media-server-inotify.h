@@ -33,20 +33,38 @@
 
 #include <glib.h>
 #include "media-server-global.h"
+#include "media-server-types.h"
+
+/*internal and external storage have their own inotify instance*/
+#define MS_INOTI_STORAGE_NUM 2
 
 typedef struct ms_ignore_file_info {
 	char *path;
-	struct ms_ignore_file_info *previous;
-	struct ms_ignore_file_info *next;
+	gint64 time;	/*monotonic time of adding*/
+	GList *link;	/*link in queue of expiry*/
 } ms_ignore_file_info;
 
+typedef struct ms_poll_dir_info {
+	char *path;
+	time_t mtime;	/*mtime of directory at the last polling*/
+} ms_poll_dir_info;
+
 int ms_inoti_init(void);
 
+/*create inotify instance of storage, it has to be called before adding watches of storage*/
+int ms_inoti_attach_storage(ms_storage_type_t storage_type);
+
+/*close inotify instance of storage, all watches of storage are removed at once*/
+void ms_inoti_detach_storage(ms_storage_type_t storage_type);
+
+/*wake event loops up to check power off*/
+void ms_inoti_stop(void);
+
 gboolean ms_inoti_thread(gpointer data);
 
-void ms_inoti_add_watch(char *path);
+bool ms_inoti_is_watched(const char *path);
 
-int ms_inoti_add_watch_with_node(ms_dir_scan_info * const current_node, int depth);
+void ms_inoti_add_watch(char *path);
 
 void ms_inoti_remove_watch_recursive(char *path);
 
@@ -56,11 +74,22 @@ void ms_inoti_modify_watch(char *path_from, char *path_to);
 
 int ms_inoti_add_ignore_file(const char *path);
 
-int ms_inoti_delete_ignore_file(ms_ignore_file_info * delete_node);
+int ms_inoti_delete_ignore_file(const char *path);
+
+bool ms_inoti_find_ignore_file(const char *path);
 
-ms_ignore_file_info *ms_inoti_find_ignore_file(const char *path);
+int ms_inoti_get_ignore_file_count(void);
 
 void ms_inoti_delete_mmc_ignore_file(void);
 
+int ms_inoti_get_poll_dir_count(void);
+
 void ms_inoti_add_watch_all_directory(ms_storage_type_t storage_type);
+
+/*file events of directories which the storage scan has not read yet are left to the scan*/
+void ms_inoti_begin_scan(ms_storage_type_t storage_type);
+
+void ms_inoti_end_scan(ms_storage_type_t storage_type);
+
+void ms_inoti_set_scan_done(const char *path);
 #endif/* _MEDIA_SERVER_INOTI_H_ */
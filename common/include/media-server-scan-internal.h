@@ -35,4 +35,6 @@
 
 void _ms_dir_scan(void **handle, ms_scan_data_t * scan_data);
 
+void _ms_dir_rescan(void **handle, ms_scan_data_t * scan_data);
+
 #endif /*_MEDIA_SERVER_SCAN_INTERNAL_H_*/
@@ -30,6 +30,10 @@
 #ifndef _MEDIA_SERVER_SCAN_H_
 #define _MEDIA_SERVER_SCAN_H_
 
+#include "media-server-types.h"
+
 gboolean ms_scan_thread(void *data);
 
+void ms_scan_request(const char *path, ms_dir_scan_type_t scan_type, time_t since);
+
 #endif /*_MEDIA_SERVER_SCAN_H_*/
\ No newline at end of file
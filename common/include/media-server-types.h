@@ -32,6 +32,7 @@
 #define _MEDIA_SERVER_TYPES_H_
 
 #include <stdbool.h>
+#include <time.h>
 #include <glib.h>
 
 #if !defined(__TYPEDEF_INT64__)
@@ -59,6 +60,7 @@ typedef enum {
 	MS_SCAN_INVALID,
 	MS_SCAN_PART,
 	MS_SCAN_ALL,
+	MS_SCAN_DIRECTORY,	/*rescan one directory, new sub directories are scanned too*/
 } ms_dir_scan_type_t;
 
 typedef enum {
@@ -66,17 +68,11 @@ typedef enum {
 	MS_DB_UPDATED = 1
 } ms_db_status_type_t;
 
-typedef struct ms_dir_scan_info {
-	char *name;
-	struct ms_dir_scan_info *parent;
-	struct ms_dir_scan_info *Rbrother;
-	struct ms_dir_scan_info *next;
-} ms_dir_scan_info;
-
 typedef struct {
 	char *path;
 	ms_storage_type_t storage_type;
 	ms_dir_scan_type_t scan_type;
+	time_t since;	/*MS_SCAN_DIRECTORY : files modified from this time are refreshed*/
 } ms_scan_data_t;
 
 /**
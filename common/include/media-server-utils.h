@@ -51,9 +51,6 @@ ms_start(bool need_db_create);
 void
 ms_end(void);
 
-int
-ms_get_full_path_from_node(ms_dir_scan_info * const node, char *ret_path, int depth);
-
 ms_storage_type_t
 ms_get_storage_type_by_full(const char *path);
 
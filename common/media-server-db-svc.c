@@ -29,6 +29,7 @@
  */
 
 #include <dlfcn.h>
+#include <unistd.h>
 
 #include <aul/aul.h>
 
@@ -38,16 +39,46 @@
 #include "media-server-db-svc.h"
 
 GMutex * db_mutex;
-extern GMutex *queue_mutex;
 
-GAsyncQueue* soc_queue;
-GArray *reg_list;
-GMutex *list_mutex;
-GMutex *queue_mutex;
+/*files in work : inotify, scanner and socket requests of one path are merged into one work*/
+GHashTable *work_table;	/*path -> ms_work_info*/
+GMutex *work_mutex;
 
 #define MS_REGISTER_COUNT 100 /*For bundle commit*/
 #define MS_VALID_COUNT 100 /*For bundle commit*/
 #define MS_MOVE_COUNT 100 /*For bundle commit*/
+#define MS_DELETE_COUNT 100 /*For bundle commit*/
+#define MS_REFRESH_COUNT 100 /*For bundle commit*/
+
+typedef enum {
+	MS_WORK_NONE = 0,
+	MS_WORK_INSERT = 1 << 0,
+	MS_WORK_REFRESH = 1 << 1,
+	MS_WORK_DELETE = 1 << 2,
+	MS_WORK_VALIDATE = 1 << 3,	/*set validity by scan, it is done after the other requests*/
+} ms_work_type_t;
+
+#define MS_WORK_MAIN (MS_WORK_INSERT | MS_WORK_REFRESH | MS_WORK_DELETE)
+#define MS_WORK_SET_VALIDITY(type) ((type) == MS_WORK_INSERT || (type) == MS_WORK_VALIDATE)
+
+typedef struct ms_work_info {
+	char *path;
+	ms_work_type_t type;	/*running work*/
+	int next;	/*requests merged while running : the latest of MS_WORK_MAIN and MS_WORK_VALIDATE, they are done after the work*/
+	int res;
+	bool done;	/*the work and all merged requests are done*/
+	int waiter;	/*the last waiter frees finished work*/
+	GCond *cond;
+} ms_work_info;
+
+typedef struct ms_batch_reg_info {
+	char *path;
+	int res;
+} ms_batch_reg_info;
+
+/*files inserted in bundle, they are kept in work until commit.
+  each DB handle has its own bundle, handle -> GArray of ms_batch_reg_info. protected by work_mutex*/
+static GHashTable *batch_reg_table;
 
 void **func_handle = NULL; /*dlopen handel*/
 
@@ -73,77 +104,209 @@ enum func_list {
 	eUPDATE_BEGIN,
 	eUPDATE_END,
 	eREFRESH_ITEM,
+	eSET_FOLDER_VALIDITY,	/*optional*/
+	eDELETE_FOLDER_INVALID_ITEMS,	/*optional*/
+	eDELETE_BEGIN,	/*optional*/
+	eDELETE_END,	/*optional*/
+	eREFRESH_BEGIN,	/*optional*/
+	eREFRESH_END,	/*optional*/
+	eMOVE_FOLDER,	/*optional*/
+	eDELETE_FOLDER,	/*optional*/
 	eFUNC_MAX
 };
 
 static void
-_ms_insert_reg_list(const char *path)
+_ms_free_work(ms_work_info *work)
 {
-	char *reg_path = strdup(path);
+	if (work->cond) g_cond_free(work->cond);
+	MS_SAFE_FREE(work->path);
+	MS_SAFE_FREE(work);
+}
+
+/*return true if the caller owns new work of path.
+  if path is in work already, the request is merged into it and false is returned,
+  in that case res gets result of the last merged request when wait is true*/
+static bool
+_ms_begin_work(const char *path, ms_work_type_t type, bool wait, int *res)
+{
+	ms_work_info *work;
+
+	g_mutex_lock(work_mutex);
+
+	work = g_hash_table_lookup(work_table, path);
+	if (work != NULL) {
+		MS_DBG("______________________ALREADY IN WORK : %d", work->type);
+
+		if (type == MS_WORK_VALIDATE) {
+			/*running insert sets validity, unless the file changes after it*/
+			if (MS_WORK_SET_VALIDITY(work->type) && work->next == MS_WORK_NONE)
+				type = MS_WORK_NONE;
+			else if (work->next & MS_WORK_DELETE)
+				work->next = MS_WORK_VALIDATE;
+			else
+				work->next |= MS_WORK_VALIDATE;
+		} else {
+			/*file is written again while it is inserted*/
+			if (type == MS_WORK_INSERT && MS_WORK_SET_VALIDITY(work->type))
+				type = ((work->next & MS_WORK_MAIN) != MS_WORK_NONE) ? MS_WORK_REFRESH : MS_WORK_NONE;
+			if (type == MS_WORK_DELETE)
+				work->next = type;
+			else if (type != MS_WORK_NONE)
+				work->next = type | (work->next & MS_WORK_VALIDATE);
+		}
+
+		/*merged request is done by the owner, the waiter is woken when all requests are done*/
+		if (wait) {
+			work->waiter++;
+			while (!work->done)
+				g_cond_wait(work->cond, work_mutex);
+			*res = work->res;
+			if (--work->waiter == 0)
+				_ms_free_work(work);
+		}
 
-	g_mutex_lock(list_mutex);
+		g_mutex_unlock(work_mutex);
+		return false;
+	}
 
-	g_array_append_val(reg_list, reg_path);
+	work = calloc(1, sizeof(ms_work_info));
+	if (work != NULL) {
+		work->path = strdup(path);
+		work->cond = g_cond_new();
+	}
+	if (work == NULL || work->path == NULL || work->cond == NULL) {
+		/*work runs without merging*/
+		MS_DBG_ERR("malloc fail");
+		if (work) _ms_free_work(work);
+		g_mutex_unlock(work_mutex);
+		return true;
+	}
+	work->type = type;
 
-	g_mutex_unlock(list_mutex);
+	g_hash_table_insert(work_table, work->path, work);
+
+	g_mutex_unlock(work_mutex);
+
+	return true;
 }
 
-static bool
-_ms_find_reg_list(const char *path)
+/*finish work of path, return the request merged while running.
+  the caller keeps the work for that request and has to end it again,
+  waiters are woken when there is no more request*/
+static ms_work_type_t
+_ms_end_work(const char *path, int res)
 {
-	int list_index;
-	int len = reg_list->len;
-	char *data;
-	bool res = false;
+	ms_work_info *work;
+	ms_work_type_t next;
 
-	g_mutex_lock(list_mutex);
-	MS_DBG("array length : %d", len);
+	g_mutex_lock(work_mutex);
 
-	for(list_index = 0; list_index < len; list_index++) {
-		data = g_array_index (reg_list, char*, list_index);
-		if(!strcmp(data, path))
-			res = true;
+	work = g_hash_table_lookup(work_table, path);
+	if (work == NULL) {
+		g_mutex_unlock(work_mutex);
+		return MS_WORK_NONE;
 	}
 
-	g_mutex_unlock(list_mutex);
+	work->res = res;
 
-	return res;
+	if (work->next != MS_WORK_NONE) {
+		/*validity is set after the other request*/
+		next = (work->next & MS_WORK_MAIN) ? (work->next & MS_WORK_MAIN) : MS_WORK_VALIDATE;
+		work->type = next;
+		work->next &= ~next;
+		g_mutex_unlock(work_mutex);
+		return next;
+	}
+
+	g_hash_table_remove(work_table, path);
+
+	work->done = true;
+	if (work->waiter > 0)
+		g_cond_broadcast(work->cond);
+	else
+		_ms_free_work(work);
+
+	g_mutex_unlock(work_mutex);
+
+	return MS_WORK_NONE;
 }
 
+static int _ms_register_file(void **handle, const char *path);
+static int _ms_refresh_item(void **handle, const char *path);
+static int _ms_delete_item(void **handle, const char *path);
+static int _ms_validate_item(void **handle, char *path, bool *inserted);
+
+/*run requests merged into the work of path until there is no more*/
 static void
-_ms_delete_reg_list(const char *path)
+_ms_run_next_work(void **handle, const char *path, ms_work_type_t next)
 {
-	int list_index;
-	int len = reg_list->len;
-	char *data;
-
-	MS_DBG("Delete : %s", path);
-	g_mutex_lock(list_mutex);
-
-	for(list_index = 0; list_index < len; list_index++) {
-		data = g_array_index (reg_list, char*, list_index);
-		if(!strcmp(data, path))	{
-			MS_DBG("Delete complete : %s", data);
-			MS_SAFE_FREE(data);
-			g_array_remove_index(reg_list, list_index);
+	int res = MS_ERR_NONE;
+
+	while (next != MS_WORK_NONE) {
+		switch (next) {
+		case MS_WORK_INSERT:
+			if (ms_check_exist(handle, path) != MS_ERR_NONE)
+				res = _ms_register_file(handle, path);
+			else
+				res = MS_ERR_NONE;
+			break;
+		case MS_WORK_REFRESH:
+			res = _ms_refresh_item(handle, path);
+			break;
+		case MS_WORK_DELETE:
+			res = _ms_delete_item(handle, path);
+			break;
+		case MS_WORK_VALIDATE:
+			res = _ms_validate_item(handle, (char *)path, NULL);
+			break;
+		default:
 			break;
 		}
+
+		next = _ms_end_work(path, res);
+	}
+}
+
+/*bundle of handle, it is created at the first use. called with work_mutex locked*/
+static GArray *
+_ms_get_batch_reg_list(void **handle)
+{
+	GArray *batch_reg_list;
+
+	if (batch_reg_table == NULL)
+		batch_reg_table = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	if (batch_reg_table == NULL) {
+		MS_DBG_ERR("g_hash_table_new failed");
+		return NULL;
+	}
+
+	batch_reg_list = g_hash_table_lookup(batch_reg_table, handle);
+	if (batch_reg_list == NULL) {
+		batch_reg_list = g_array_new(FALSE, FALSE, sizeof(ms_batch_reg_info*));
+		if (batch_reg_list != NULL)
+			g_hash_table_insert(batch_reg_table, handle, batch_reg_list);
 	}
 
-	g_mutex_unlock(list_mutex);
+	return batch_reg_list;
 }
 
-static int
-_ms_get_mime(const char *path, char *mimetype)
+int
+ms_get_item_mime(const char *path, char *mimetype, bool *drm)
 {
 	int ret = 0;
+	bool is_drm;
 
 	if (path == NULL)
 		return MS_ERR_ARG_INVALID;
 
 	/*get content type and mime type from file. */
 	/*in case of drm file. */
-	if (ms_is_drm_file(path)) {
+	is_drm = ms_is_drm_file(path);
+	if (drm != NULL)
+		*drm = is_drm;
+
+	if (is_drm) {
 
 		ms_inoti_add_ignore_file(path);
 
@@ -163,6 +326,12 @@ _ms_get_mime(const char *path, char *mimetype)
 	return MS_ERR_NONE;
 }
 
+static int
+_ms_get_mime(const char *path, char *mimetype)
+{
+	return ms_get_item_mime(path, mimetype, NULL);
+}
+
 #define CONFIG_PATH "/opt/data/file-manager-service/plugin-config"
 #define EXT ".so"
 #define EXT_LEN 3
@@ -264,7 +433,15 @@ ms_load_functions(void)
 		"delete_all_invalid_items_in_storage",
 		"update_begin",
 		"update_end",
-		"refresh_item"
+		"refresh_item",
+		"set_folder_item_validity",
+		"delete_all_invalid_items_in_folder",
+		"delete_item_begin",
+		"delete_item_end",
+		"refresh_item_begin",
+		"refresh_item_end",
+		"move_folder",
+		"delete_folder"
 		};
 	/*init array for adding name of so*/
 	so_array = g_array_new(FALSE, FALSE, sizeof(char*));
@@ -279,6 +456,10 @@ ms_load_functions(void)
 
 	/*the number of functions*/
 	lib_num = so_array->len;
+	if (lib_num > MS_PLUGIN_MAX) {
+		MS_DBG_ERR("Too many plugins : %d, only %d are used", lib_num, MS_PLUGIN_MAX);
+		lib_num = MS_PLUGIN_MAX;
+	}
 
 	MS_DBG("The number of information of so : %d", lib_num);
 	func_handle = malloc(sizeof(void*) * lib_num);
@@ -384,21 +565,16 @@ ms_disconnect_db(void ***handle)
 	return MS_ERR_NONE;
 }
 
-int
-ms_validate_item(void **handle, char *path)
+/*inserted is set if the file is inserted in bundle of handle, it may be NULL*/
+static int
+_ms_validate_item_with_mime(void **handle, char *path, const char *mimetype, bool drm, bool *inserted)
 {
 	int lib_index;
 	int res = MS_ERR_NONE;
 	int ret;
 	char *err_msg = NULL;
-	char mimetype[255] = {0};
 	ms_storage_type_t storage_type;
 
-	ret = _ms_get_mime(path, mimetype);
-	if (ret != MS_ERR_NONE) {
-		MS_DBG_ERR("err : _ms_get_mime [%d]", ret);
-		return ret;
-	}
 	storage_type = ms_get_storage_type_by_full(path);
 
 	MS_DBG("[%s] %s", mimetype, path);
@@ -416,6 +592,8 @@ ms_validate_item(void **handle, char *path)
 					MS_DBG_ERR("error : %s [%s] %s", g_array_index(so_array, char*, lib_index), err_msg, path);
 					MS_SAFE_FREE(err_msg);
 					res = MS_ERR_DB_INSERT_RECORD_FAIL;
+				} else if (inserted != NULL) {
+					*inserted = true;
 				}
 			} else {
 				/*if meta data of file exist, change valid field to "1" */
@@ -429,13 +607,81 @@ ms_validate_item(void **handle, char *path)
 		}
 	}
 
-	if (ms_is_drm_file(path)) {
+	if (drm) {
 		ret = ms_drm_register(path);
 	}
 
 	return res;
 }
 
+static int
+_ms_validate_item(void **handle, char *path, bool *inserted)
+{
+	int ret;
+	bool drm = false;
+	char mimetype[255] = {0};
+
+	ret = ms_get_item_mime(path, mimetype, &drm);
+	if (ret != MS_ERR_NONE) {
+		MS_DBG_ERR("err : ms_get_item_mime [%d]", ret);
+		return ret;
+	}
+
+	return _ms_validate_item_with_mime(handle, path, mimetype, drm, inserted);
+}
+
+static void _ms_add_batch_reg(void **handle, const char *path, int res);
+
+/*validation of scan runs in its bundle, inserted file is kept in work until commit*/
+static void
+_ms_end_validate_work(void **handle, const char *path, int res, bool inserted)
+{
+	if (inserted)
+		_ms_add_batch_reg(handle, path, res);
+	else
+		_ms_run_next_work(handle, path, _ms_end_work(path, res));
+}
+
+int
+ms_validate_item(void **handle, char *path)
+{
+	int res;
+	bool inserted = false;
+
+	/*the other work sets validity after it is done*/
+	if (!_ms_begin_work(path, MS_WORK_VALIDATE, false, NULL))
+		return MS_ERR_NONE;
+
+	res = _ms_validate_item(handle, path, &inserted);
+
+	_ms_end_validate_work(handle, path, res, inserted);
+
+	return res;
+}
+
+int
+ms_validate_item_with_mime(void **handle, char *path, const char *mimetype, bool drm)
+{
+	int res;
+	bool inserted = false;
+
+	/*the other work sets validity after it is done*/
+	if (!_ms_begin_work(path, MS_WORK_VALIDATE, false, NULL))
+		return MS_ERR_NONE;
+
+	/*scan read the directory a while ago, deleted file is left invalid*/
+	if (access(path, F_OK) != 0) {
+		_ms_run_next_work(handle, path, _ms_end_work(path, MS_ERR_FILE_NOT_FOUND));
+		return MS_ERR_FILE_NOT_FOUND;
+	}
+
+	res = _ms_validate_item_with_mime(handle, path, mimetype, drm, &inserted);
+
+	_ms_end_validate_work(handle, path, res, inserted);
+
+	return res;
+}
+
 int
 ms_invalidate_all_items(void **handle, ms_storage_type_t store_type)
 {
@@ -456,41 +702,12 @@ ms_invalidate_all_items(void **handle, ms_storage_type_t store_type)
 	return res;
 }
 
-int
-ms_register_file(void **handle, const char *path, GAsyncQueue* queue)
+static int
+_ms_register_file(void **handle, const char *path)
 {
-	MS_DBG("[%d]register file : %s", syscall(__NR_gettid), path);
-
 	int res = MS_ERR_NONE;
 	int ret;
 
-	if (path == NULL) {
-		return MS_ERR_ARG_INVALID;
-	}
-
-	/*check item in DB. If it exist in DB, return directly.*/
-	ret = ms_check_exist(handle, path);
-	if (ret == MS_ERR_NONE) {
-		MS_DBG("Already exist");
-		return MS_ERR_NONE;
-	}
-
-	g_mutex_lock(queue_mutex);
-	/*first request for this file*/
-	if(!_ms_find_reg_list(path)) {
-		/*insert registering file list*/
-		_ms_insert_reg_list(path);
-	} else {
-		MS_DBG("______________________ALREADY INSERTING");
-		if(queue != NULL) {
-			MS_DBG("Need reply");
-			soc_queue = queue;
-		}
-		g_mutex_unlock(queue_mutex);
-		return MS_ERR_NOW_REGISTER_FILE;
-	}
-	g_mutex_unlock(queue_mutex);
-
 	ret = ms_insert_item(handle, path);
 	if (ret != MS_ERR_NONE) {
 		int lib_index;
@@ -528,36 +745,188 @@ END:
 		ret = ms_drm_register(path);
 	}
 
-	g_mutex_lock(queue_mutex);
+	return res;
+}
+
+int
+ms_register_file(void **handle, const char *path, bool wait)
+{
+	MS_DBG("[%d]register file : %s", syscall(__NR_gettid), path);
+
+	int res = MS_ERR_NONE;
+	int ret;
 
-	_ms_delete_reg_list(path);
+	if (path == NULL) {
+		return MS_ERR_ARG_INVALID;
+	}
 
-	if (soc_queue != NULL) {
-		MS_DBG("%d", res);
-		g_async_queue_push(soc_queue, GINT_TO_POINTER(res+MS_ERR_MAX));
-		MS_DBG("Return OK");
+	/*check item in DB. If it exist in DB, return directly.*/
+	ret = ms_check_exist(handle, path);
+	if (ret == MS_ERR_NONE) {
+		MS_DBG("Already exist");
+		return MS_ERR_NONE;
 	}
-	soc_queue = NULL;
-	g_mutex_unlock(queue_mutex);
+
+	/*the other work registers this file, wait it if reply is needed*/
+	if (!_ms_begin_work(path, MS_WORK_INSERT, wait, &res))
+		return wait ? res : MS_ERR_NOW_REGISTER_FILE;
+
+	res = _ms_register_file(handle, path);
+
+	_ms_run_next_work(handle, path, _ms_end_work(path, res));
 
 	return res;
 }
 
+/*inserted file is kept in work until the bundle of handle is committed*/
+static void
+_ms_add_batch_reg(void **handle, const char *path, int res)
+{
+	ms_batch_reg_info *batch_reg;
+	GArray *batch_reg_list;
+
+	batch_reg = malloc(sizeof(ms_batch_reg_info));
+	if (batch_reg != NULL)
+		batch_reg->path = strdup(path);
+
+	if (batch_reg == NULL || batch_reg->path == NULL) {
+		MS_DBG_ERR("malloc fail");
+		if (batch_reg) MS_SAFE_FREE(batch_reg);
+		_ms_run_next_work(handle, path, _ms_end_work(path, res));
+		return;
+	}
+
+	batch_reg->res = res;
+
+	g_mutex_lock(work_mutex);
+	batch_reg_list = _ms_get_batch_reg_list(handle);
+	if (batch_reg_list != NULL)
+		g_array_append_val(batch_reg_list, batch_reg);
+	g_mutex_unlock(work_mutex);
+
+	if (batch_reg_list == NULL) {
+		_ms_run_next_work(handle, path, _ms_end_work(path, res));
+		MS_SAFE_FREE(batch_reg->path);
+		MS_SAFE_FREE(batch_reg);
+	}
+}
+
+/*files of bundle are in DB now, run the requests merged into them and reply to the waiting request*/
+static void
+_ms_end_batch_reg(void **handle)
+{
+	int list_index;
+	ms_batch_reg_info *batch_reg;
+	GArray *batch_reg_list;
+
+	g_mutex_lock(work_mutex);
+	batch_reg_list = (batch_reg_table != NULL) ? g_hash_table_lookup(batch_reg_table, handle) : NULL;
+	if (batch_reg_list != NULL)
+		g_hash_table_steal(batch_reg_table, handle);
+	g_mutex_unlock(work_mutex);
+
+	if (batch_reg_list == NULL)
+		return;
+
+	for (list_index = 0; list_index < batch_reg_list->len; list_index++) {
+		batch_reg = g_array_index(batch_reg_list, ms_batch_reg_info*, list_index);
+
+		_ms_run_next_work(handle, batch_reg->path, _ms_end_work(batch_reg->path, batch_reg->res));
+
+		MS_SAFE_FREE(batch_reg->path);
+		MS_SAFE_FREE(batch_reg);
+	}
+
+	g_array_free(batch_reg_list, TRUE);
+}
+
+int
+ms_register_file_batch(void **handle, const char *path)
+{
+	MS_DBG("[%d]register file in bundle : %s", syscall(__NR_gettid), path);
+
+	int ret;
+
+	if (path == NULL) {
+		return MS_ERR_ARG_INVALID;
+	}
+
+	/*check item in DB. If it exist in DB, return directly.*/
+	ret = ms_check_exist(handle, path);
+	if (ret == MS_ERR_NONE) {
+		MS_DBG("Already exist");
+		return MS_ERR_NONE;
+	}
+
+	if (!_ms_begin_work(path, MS_WORK_INSERT, false, NULL))
+		return MS_ERR_NOW_REGISTER_FILE;
+
+	ret = ms_insert_item_batch(handle, path);
+
+	_ms_add_batch_reg(handle, path, ret);
+
+	return ret;
+}
+
+int
+ms_register_file_batch_with_mime(void **handle, const char *path, const char *mimetype, bool drm)
+{
+	int ret;
+
+	if (path == NULL) {
+		return MS_ERR_ARG_INVALID;
+	}
+
+	/*inotify or socket request inserts it, the scan does not wait*/
+	if (!_ms_begin_work(path, MS_WORK_INSERT, false, NULL))
+		return MS_ERR_NOW_REGISTER_FILE;
+
+	/*scan read the directory a while ago, the file may be deleted since then.
+	  delete after this check is merged into the work and runs after the insert*/
+	if (access(path, F_OK) != 0) {
+		_ms_run_next_work(handle, path, _ms_end_work(path, MS_ERR_FILE_NOT_FOUND));
+		return MS_ERR_FILE_NOT_FOUND;
+	}
+
+	/*inotify inserts new files of directory which is scanned already*/
+	if (ms_check_exist(handle, path) == MS_ERR_NONE) {
+		MS_DBG("Already exist");
+		_ms_run_next_work(handle, path, _ms_end_work(path, MS_ERR_NONE));
+		return MS_ERR_NONE;
+	}
+
+	ret = ms_insert_item_batch_with_mime(handle, path, mimetype, drm);
+
+	_ms_add_batch_reg(handle, path, ret);
+
+	return ret;
+}
+
 int
 ms_insert_item_batch(void **handle, const char *path)
 {
-	int lib_index;
-	int res = MS_ERR_NONE;
 	int ret;
+	bool drm = false;
 	char mimetype[255] = {0};
-	char *err_msg = NULL;
-	ms_storage_type_t storage_type;
 
-	ret = _ms_get_mime(path, mimetype);
+	ret = ms_get_item_mime(path, mimetype, &drm);
 	if (ret != MS_ERR_NONE) {
-		MS_DBG_ERR("err : _ms_get_mime [%d]", ret);
+		MS_DBG_ERR("err : ms_get_item_mime [%d]", ret);
 		return ret;
 	}
+
+	return ms_insert_item_batch_with_mime(handle, path, mimetype, drm);
+}
+
+int
+ms_insert_item_batch_with_mime(void **handle, const char *path, const char *mimetype, bool drm)
+{
+	int lib_index;
+	int res = MS_ERR_NONE;
+	int ret;
+	char *err_msg = NULL;
+	ms_storage_type_t storage_type;
+
 	storage_type = ms_get_storage_type_by_full(path);
 
 	MS_DBG("[%s] %s", mimetype, path);
@@ -573,7 +942,7 @@ ms_insert_item_batch(void **handle, const char *path)
 		}
 	}
 
-	if (ms_is_drm_file(path)) {
+	if (drm) {
 		ret = ms_drm_register(path);
 		res = ret;
 	}
@@ -614,8 +983,8 @@ ms_insert_item(void **handle, const char *path)
 	return res;
 }
 
-int
-ms_delete_item(void **handle, const char *path)
+static int
+_ms_delete_item(void **handle, const char *path)
 {
 	int lib_index;
 	int res = MS_ERR_NONE;
@@ -648,10 +1017,35 @@ ms_delete_item(void **handle, const char *path)
 	return res;
 }
 
+int
+ms_delete_item(void **handle, const char *path)
+{
+	int res;
+
+	/*it is deleted after the other work*/
+	if (!_ms_begin_work(path, MS_WORK_DELETE, false, NULL))
+		return MS_ERR_NONE;
+
+	res = _ms_delete_item(handle, path);
+
+	_ms_run_next_work(handle, path, _ms_end_work(path, res));
+
+	return res;
+}
+
 int
 ms_move_item(void **handle,
 		ms_storage_type_t src_store, ms_storage_type_t dst_store,
 		const char *src_path, const char *dst_path)
+{
+	return ms_move_item_by_plugins(handle, MS_PLUGIN_ALL, src_store, dst_store, src_path, dst_path);
+}
+
+/*move item only in plugins of the mask*/
+int
+ms_move_item_by_plugins(void **handle, unsigned int plugins,
+		ms_storage_type_t src_store, ms_storage_type_t dst_store,
+		const char *src_path, const char *dst_path)
 {
 	int lib_index;
 	int res = MS_ERR_NONE;
@@ -667,6 +1061,9 @@ ms_move_item(void **handle,
 	MS_DBG("[%s] %s", mimetype, dst_path);
 
 	for (lib_index = 0; lib_index < lib_num; lib_index++) {
+		if (!(plugins & MS_PLUGIN_BIT(lib_index)))
+			continue;
+
 		if (!_ms_check_category(dst_path, mimetype, lib_index)) {
 			ret = ((MOVE_ITEM)func_array[lib_index][eMOVE])(handle[lib_index], src_path, src_store,
 							dst_path, dst_store, mimetype, &err_msg); /*dlopen*/
@@ -720,8 +1117,8 @@ ms_delete_invalid_items(void **handle, ms_storage_type_t store_type)
 	return true;
 }
 
-int
-ms_refresh_item(void **handle, const char *path)
+static int
+_ms_refresh_item(void **handle, const char *path)
 {
 	int lib_index;
 	int res = MS_ERR_NONE;
@@ -753,6 +1150,157 @@ ms_refresh_item(void **handle, const char *path)
 	return res;
 }
 
+int
+ms_refresh_item(void **handle, const char *path)
+{
+	int res;
+
+	/*it is refreshed after the other work*/
+	if (!_ms_begin_work(path, MS_WORK_REFRESH, false, NULL))
+		return MS_ERR_NONE;
+
+	res = _ms_refresh_item(handle, path);
+
+	_ms_run_next_work(handle, path, _ms_end_work(path, res));
+
+	return res;
+}
+
+static bool
+_ms_support_function(int func_index)
+{
+	int lib_index;
+
+	for (lib_index = 0; lib_index < lib_num; lib_index++) {
+		if (func_array[lib_index][func_index] == NULL)
+			return false;
+	}
+
+	return true;
+}
+
+bool
+ms_support_folder_validity(void)
+{
+	return (_ms_support_function(eSET_FOLDER_VALIDITY)
+		&& _ms_support_function(eDELETE_FOLDER_INVALID_ITEMS));
+}
+
+int
+ms_invalidate_folder_items(void **handle, const char *path)
+{
+	int lib_index;
+	int res = MS_ERR_NONE;
+	int ret;
+	char *err_msg = NULL;
+
+	for (lib_index = 0; lib_index < lib_num; lib_index++) {
+		ret = ((SET_FOLDER_ITEM_VALIDITY)func_array[lib_index][eSET_FOLDER_VALIDITY])(handle[lib_index], path, false, false, &err_msg); /*dlopen*/
+		if (ret != 0) {
+			MS_DBG_ERR("error : %s [%s] %s", g_array_index(so_array, char*, lib_index), err_msg, path);
+			MS_SAFE_FREE(err_msg);
+			res = MS_ERR_DB_UPDATE_RECORD_FAIL;
+		}
+	}
+
+	return res;
+}
+
+int
+ms_delete_invalid_folder_items(void **handle, const char *path)
+{
+	int lib_index;
+	int res = MS_ERR_NONE;
+	int ret;
+	char *err_msg = NULL;
+
+	for (lib_index = 0; lib_index < lib_num; lib_index++) {
+		ret = ((DELETE_ALL_INVALID_ITEMS_IN_FOLDER)func_array[lib_index][eDELETE_FOLDER_INVALID_ITEMS])(handle[lib_index], path, &err_msg); /*dlopen*/
+		if (ret != 0) {
+			MS_DBG_ERR("error : %s [%s] %s", g_array_index(so_array, char*, lib_index), err_msg, path);
+			MS_SAFE_FREE(err_msg);
+			res = MS_ERR_DB_DELETE_RECORD_FAIL;
+		}
+	}
+
+	return res;
+}
+
+bool
+ms_support_move_folder(void)
+{
+	int lib_index;
+
+	/*plugins without it move each file*/
+	for (lib_index = 0; lib_index < lib_num; lib_index++) {
+		if (func_array[lib_index][eMOVE_FOLDER] != NULL)
+			return true;
+	}
+
+	return false;
+}
+
+/*rewrite path prefix of all items under the folder at once,
+  plugins which can not do it are set in rest and have to move each item*/
+int
+ms_move_folder(void **handle,
+		ms_storage_type_t src_store, ms_storage_type_t dst_store,
+		const char *src_path, const char *dst_path, unsigned int *rest)
+{
+	int lib_index;
+	int res = MS_ERR_NONE;
+	int ret;
+	char *err_msg = NULL;
+
+	*rest = 0;
+
+	for (lib_index = 0; lib_index < lib_num; lib_index++) {
+		if (func_array[lib_index][eMOVE_FOLDER] == NULL) {
+			*rest |= MS_PLUGIN_BIT(lib_index);
+			res = MS_ERR_DB_UPDATE_RECORD_FAIL;
+			continue;
+		}
+
+		ret = ((MOVE_FOLDER)func_array[lib_index][eMOVE_FOLDER])(handle[lib_index], src_path, src_store,
+							dst_path, dst_store, &err_msg); /*dlopen*/
+		if (ret != 0) {
+			MS_DBG_ERR("error : %s [%s] %s", g_array_index(so_array, char*, lib_index), err_msg, src_path);
+			MS_SAFE_FREE(err_msg);
+			*rest |= MS_PLUGIN_BIT(lib_index);
+			res = MS_ERR_DB_UPDATE_RECORD_FAIL;
+		}
+	}
+
+	return res;
+}
+
+bool
+ms_support_delete_folder(void)
+{
+	return _ms_support_function(eDELETE_FOLDER);
+}
+
+/*delete all items under the folder and its sub folders at once*/
+int
+ms_delete_folder(void **handle, const char *path)
+{
+	int lib_index;
+	int res = MS_ERR_NONE;
+	int ret;
+	char *err_msg = NULL;
+
+	for (lib_index = 0; lib_index < lib_num; lib_index++) {
+		ret = ((DELETE_FOLDER)func_array[lib_index][eDELETE_FOLDER])(handle[lib_index], path, &err_msg); /*dlopen*/
+		if (ret != 0) {
+			MS_DBG_ERR("error : %s [%s] %s", g_array_index(so_array, char*, lib_index), err_msg, path);
+			MS_SAFE_FREE(err_msg);
+			res = MS_ERR_DB_DELETE_RECORD_FAIL;
+		}
+	}
+
+	return res;
+}
+
 int
 ms_check_exist(void **handle, const char *path)
 {
@@ -792,8 +1340,8 @@ ms_register_start(void **handle)
 	}
 }
 
-void
-ms_register_end(void **handle)
+static void
+_ms_register_end(void **handle)
 {
 	int lib_index;
 	int ret = 0;
@@ -808,6 +1356,14 @@ ms_register_end(void **handle)
 	}
 }
 
+void
+ms_register_end(void **handle)
+{
+	_ms_register_end(handle);
+
+	_ms_end_batch_reg(handle);
+}
+
 void
 ms_validate_start(void **handle)
 {
@@ -871,3 +1427,103 @@ ms_move_end(void **handle)
 		}
 	}
 }
+
+void
+ms_delete_start(void **handle)
+{
+	int lib_index;
+	int ret;
+	char *err_msg = NULL;
+
+	for (lib_index = 0; lib_index < lib_num; lib_index++) {
+		if (func_array[lib_index][eDELETE_BEGIN] == NULL)
+			continue;
+
+		ret = ((DELETE_ITEM_BEGIN)func_array[lib_index][eDELETE_BEGIN])(handle[lib_index], MS_DELETE_COUNT, &err_msg);/*dlopen*/
+		if (ret != 0) {
+			MS_DBG_ERR("error : %s [%s]", g_array_index(so_array, char*, lib_index), err_msg);
+			MS_SAFE_FREE(err_msg);
+		}
+	}
+}
+
+void
+ms_delete_end(void **handle)
+{
+	int lib_index;
+	int ret;
+	char *err_msg = NULL;
+
+	for (lib_index = 0; lib_index < lib_num; lib_index++) {
+		if (func_array[lib_index][eDELETE_END] == NULL)
+			continue;
+
+		ret = ((DELETE_ITEM_END)func_array[lib_index][eDELETE_END])(handle[lib_index], &err_msg);/*dlopen*/
+		if (ret != 0) {
+			MS_DBG_ERR("error : %s [%s]", g_array_index(so_array, char*, lib_index), err_msg);
+			MS_SAFE_FREE(err_msg);
+		}
+	}
+}
+
+void
+ms_refresh_start(void **handle)
+{
+	int lib_index;
+	int ret;
+	char *err_msg = NULL;
+
+	for (lib_index = 0; lib_index < lib_num; lib_index++) {
+		if (func_array[lib_index][eREFRESH_BEGIN] == NULL)
+			continue;
+
+		ret = ((REFRESH_ITEM_BEGIN)func_array[lib_index][eREFRESH_BEGIN])(handle[lib_index], MS_REFRESH_COUNT, &err_msg);/*dlopen*/
+		if (ret != 0) {
+			MS_DBG_ERR("error : %s [%s]", g_array_index(so_array, char*, lib_index), err_msg);
+			MS_SAFE_FREE(err_msg);
+		}
+	}
+}
+
+void
+ms_refresh_end(void **handle)
+{
+	int lib_index;
+	int ret;
+	char *err_msg = NULL;
+
+	for (lib_index = 0; lib_index < lib_num; lib_index++) {
+		if (func_array[lib_index][eREFRESH_END] == NULL)
+			continue;
+
+		ret = ((REFRESH_ITEM_END)func_array[lib_index][eREFRESH_END])(handle[lib_index], &err_msg);/*dlopen*/
+		if (ret != 0) {
+			MS_DBG_ERR("error : %s [%s]", g_array_index(so_array, char*, lib_index), err_msg);
+			MS_SAFE_FREE(err_msg);
+		}
+	}
+}
+
+void
+ms_batch_start(void **handle)
+{
+	g_mutex_lock(work_mutex);
+	_ms_get_batch_reg_list(handle);
+	g_mutex_unlock(work_mutex);
+
+	ms_register_start(handle);
+	ms_move_start(handle);
+	ms_delete_start(handle);
+	ms_refresh_start(handle);
+}
+
+void
+ms_batch_end(void **handle)
+{
+	_ms_register_end(handle);
+	ms_move_end(handle);
+	ms_delete_end(handle);
+	ms_refresh_end(handle);
+
+	_ms_end_batch_reg(handle);
+}
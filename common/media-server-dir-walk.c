@@ -0,0 +1,345 @@
+/*
+ *  Media Server
+ *
+ * Copyright (c) 2000 - 2011 Samsung Electronics Co., Ltd. All rights reserved.
+ *
+ * Contact: Yong Yeon Kim <yy9875.kim@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * This file defines api utilities of contents manager engines.
+ *
+ * @file		media-server-dir-walk.c
+ * @author	Yong Yeon Kim(yy9875.kim@samsung.com)
+ * @version	1.0
+ * @brief
+ */
+#include "media-server-dir-walk.h"
+
+#define MS_WALK_BUF_SIZE 32768 /*getdents64 fills this at once, a few hundreds of camera files*/
+
+/*record of getdents64*/
+typedef struct ms_dirent64 {
+	guint64 d_ino;
+	gint64 d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+} ms_dirent64;
+
+typedef struct ms_walk_frame {
+	int fd;
+	int path_len;	/*length of directory path in the path buffer*/
+	char *buf;	/*records of the last getdents64 call*/
+	int len;
+	int pos;	/*next record to look for sub directory*/
+	bool batched;	/*files of records in buf are handed already*/
+} ms_walk_frame;
+
+typedef struct ms_walk_info {
+	GArray *stack;	/*ms_walk_frame*/
+	GPtrArray *spare_bufs;	/*buffers of finished frames, they are reused by next frames*/
+	GArray *entries;	/*ms_dir_entry of current batch*/
+	char *path;	/*one path buffer is shared by all levels*/
+	ms_walk_dir_cb dir_func;
+	ms_walk_file_cb file_func;
+	void *user_data;
+	bool flat;	/*only the first directory is read, sub directories are handed to dir_func*/
+} ms_walk_info;
+
+static void _ms_walk_pop(ms_walk_info *walk)
+{
+	ms_walk_frame *top = &g_array_index(walk->stack, ms_walk_frame, walk->stack->len - 1);
+
+	close(top->fd);
+	g_ptr_array_add(walk->spare_bufs, top->buf);
+	g_array_set_size(walk->stack, walk->stack->len - 1);
+}
+
+/*enter directory of path, it is read next*/
+static ms_walk_result_t _ms_walk_enter(ms_walk_info *walk, int path_len, int parent_fd, const char *name)
+{
+	int fd;
+	ms_walk_frame frame;
+	ms_walk_result_t res;
+
+	if (walk->flat) {
+		/*sub directory is read by caller later*/
+		if (walk->stack->len > 0)
+			return (walk->dir_func != NULL) ? walk->dir_func(walk->path, walk->user_data) : MS_WALK_CONTINUE;
+	} else if (walk->dir_func != NULL) {
+		res = walk->dir_func(walk->path, walk->user_data);
+		if (res != MS_WALK_CONTINUE)
+			return res;
+	}
+
+	if (parent_fd >= 0)
+		fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	else
+		fd = open(walk->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (fd < 0) {
+		MS_DBG_ERR("%s folder open fails : %s", walk->path, strerror(errno));
+		return MS_WALK_SKIP;
+	}
+
+	if (walk->spare_bufs->len > 0) {
+		frame.buf = g_ptr_array_index(walk->spare_bufs, walk->spare_bufs->len - 1);
+		g_ptr_array_remove_index_fast(walk->spare_bufs, walk->spare_bufs->len - 1);
+	} else {
+		frame.buf = malloc(MS_WALK_BUF_SIZE);
+		if (frame.buf == NULL) {
+			MS_DBG_ERR("malloc fail");
+			close(fd);
+			return MS_WALK_STOP;
+		}
+	}
+
+	frame.fd = fd;
+	frame.path_len = path_len;
+	frame.len = 0;
+	frame.pos = 0;
+	frame.batched = true;
+	g_array_append_val(walk->stack, frame);
+
+	return MS_WALK_CONTINUE;
+}
+
+/*some file systems do not fill d_type*/
+static unsigned char _ms_walk_get_type(int dir_fd, const char *name)
+{
+	struct stat st;
+
+	if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+		return DT_UNKNOWN;
+
+	if (S_ISDIR(st.st_mode))
+		return DT_DIR;
+	if (S_ISREG(st.st_mode))
+		return DT_REG;
+	if (S_ISLNK(st.st_mode))
+		return DT_LNK;
+
+	return DT_UNKNOWN;
+}
+
+/*type is resolved in place, sub directory search of the same records does not stat again*/
+static unsigned char _ms_walk_resolve_type(int dir_fd, ms_dirent64 *ent)
+{
+	if (ent->d_type == DT_UNKNOWN)
+		ent->d_type = _ms_walk_get_type(dir_fd, ent->d_name);
+
+	return ent->d_type;
+}
+
+/*hand files of records in buffer as one batch*/
+static ms_walk_result_t _ms_walk_file_batch(ms_walk_info *walk, ms_walk_frame *top)
+{
+	int pos;
+	ms_dirent64 *ent;
+	ms_dir_entry entry;
+	ms_walk_batch batch;
+
+	g_array_set_size(walk->entries, 0);
+
+	for (pos = top->pos; pos < top->len; pos += ent->d_reclen) {
+		ent = (ms_dirent64 *)(top->buf + pos);
+
+		if (ent->d_name[0] == '.')
+			continue;
+
+		if (_ms_walk_resolve_type(top->fd, ent) == DT_DIR)
+			continue;
+
+		entry.name = ent->d_name;
+		entry.ino = ent->d_ino;
+		entry.type = ent->d_type;
+		g_array_append_val(walk->entries, entry);
+	}
+
+	if (walk->entries->len == 0)
+		return MS_WALK_CONTINUE;
+
+	walk->path[top->path_len] = '\0';
+
+	batch.dir_fd = top->fd;
+	batch.path = walk->path;
+	batch.dir_len = top->path_len;
+	batch.entries = (ms_dir_entry *)walk->entries->data;
+	batch.count = walk->entries->len;
+
+	return walk->file_func(&batch, walk->user_data);
+}
+
+/*find next sub directory in records, -1 if there is no more*/
+static int _ms_walk_next_dir(ms_walk_frame *top)
+{
+	int pos;
+	ms_dirent64 *ent;
+
+	for (pos = top->pos; pos < top->len; pos += ent->d_reclen) {
+		ent = (ms_dirent64 *)(top->buf + pos);
+
+		if (ent->d_name[0] == '.')
+			continue;
+
+		if (_ms_walk_resolve_type(top->fd, ent) == DT_DIR) {
+			top->pos = pos + ent->d_reclen;
+			return pos;
+		}
+	}
+
+	top->pos = top->len;
+
+	return -1;
+}
+
+static void _ms_walk_free(ms_walk_info *walk)
+{
+	guint i;
+
+	if (walk->stack != NULL) {
+		while (walk->stack->len > 0)
+			_ms_walk_pop(walk);
+		g_array_free(walk->stack, TRUE);
+	}
+
+	if (walk->spare_bufs != NULL) {
+		for (i = 0; i < walk->spare_bufs->len; i++)
+			free(g_ptr_array_index(walk->spare_bufs, i));
+		g_ptr_array_free(walk->spare_bufs, TRUE);
+	}
+
+	if (walk->entries != NULL)
+		g_array_free(walk->entries, TRUE);
+
+	MS_SAFE_FREE(walk->path);
+}
+
+static int _ms_walk_run(const char *path, ms_walk_dir_cb dir_func, ms_walk_file_cb file_func, void *user_data, bool flat)
+{
+	int len;
+	int name_len;
+	int pos;
+	int err = MS_ERR_NONE;
+	ms_walk_info walk;
+	ms_walk_frame *top;
+	ms_dirent64 *ent;
+	ms_walk_result_t res;
+
+	if (path == NULL)
+		return MS_ERR_ARG_INVALID;
+
+	len = strlen(path);
+	if (len >= MS_FILE_PATH_LEN_MAX)
+		return MS_ERR_INVALID_DIR_PATH;
+
+	memset(&walk, 0, sizeof(ms_walk_info));
+	walk.dir_func = dir_func;
+	walk.file_func = file_func;
+	walk.user_data = user_data;
+	walk.flat = flat;
+	walk.path = malloc(MS_FILE_PATH_LEN_MAX);
+	walk.stack = g_array_new(FALSE, FALSE, sizeof(ms_walk_frame));
+	walk.spare_bufs = g_ptr_array_new();
+	walk.entries = g_array_new(FALSE, FALSE, sizeof(ms_dir_entry));
+	if (walk.path == NULL || walk.stack == NULL || walk.spare_bufs == NULL || walk.entries == NULL) {
+		MS_DBG_ERR("walk init fail");
+		_ms_walk_free(&walk);
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+	memcpy(walk.path, path, len + 1);
+
+	res = _ms_walk_enter(&walk, len, -1, NULL);
+	if (res == MS_WALK_SKIP)
+		err = MS_ERR_DIR_OPEN_FAIL;
+
+	while (res != MS_WALK_STOP && walk.stack->len > 0) {
+		top = &g_array_index(walk.stack, ms_walk_frame, walk.stack->len - 1);
+
+		if (top->pos >= top->len) {
+			len = syscall(SYS_getdents64, top->fd, top->buf, MS_WALK_BUF_SIZE);
+			if (len <= 0) {
+				if (len < 0)
+					MS_DBG_ERR("getdents64 failed : %s", strerror(errno));
+				_ms_walk_pop(&walk);
+				continue;
+			}
+
+			top->len = len;
+			top->pos = 0;
+			top->batched = false;
+		}
+
+		/*files are handed before sub directories of same records are entered*/
+		if (!top->batched) {
+			top->batched = true;
+			if (file_func != NULL) {
+				res = _ms_walk_file_batch(&walk, top);
+				continue;
+			}
+		}
+
+		pos = _ms_walk_next_dir(top);
+		if (pos < 0)
+			continue;
+
+		ent = (ms_dirent64 *)(top->buf + pos);
+		len = top->path_len;
+		name_len = strlen(ent->d_name);
+		if (len + name_len + 2 > MS_FILE_PATH_LEN_MAX) {
+			walk.path[len] = '\0';
+			MS_DBG_ERR("path is too long : %s/%s", walk.path, ent->d_name);
+			continue;
+		}
+
+		walk.path[len] = '/';
+		memcpy(walk.path + len + 1, ent->d_name, name_len + 1);
+
+		/*top is not valid after this, stack can be reallocated*/
+		res = _ms_walk_enter(&walk, len + name_len + 1, top->fd, ent->d_name);
+	}
+
+	_ms_walk_free(&walk);
+
+	return err;
+}
+
+int ms_walk_dir(const char *path, ms_walk_dir_cb dir_func, ms_walk_file_cb file_func, void *user_data)
+{
+	return _ms_walk_run(path, dir_func, file_func, user_data, false);
+}
+
+int ms_read_dir(const char *path, ms_walk_dir_cb dir_func, ms_walk_file_cb file_func, void *user_data)
+{
+	return _ms_walk_run(path, dir_func, file_func, user_data, true);
+}
+
+const char *ms_walk_entry_path(ms_walk_batch *batch, int index)
+{
+	const char *name = batch->entries[index].name;
+	int name_len = strlen(name);
+
+	if (batch->dir_len + name_len + 2 > MS_FILE_PATH_LEN_MAX) {
+		MS_DBG_ERR("path is too long : %s", name);
+		return NULL;
+	}
+
+	batch->path[batch->dir_len] = '/';
+	memcpy(batch->path + batch->dir_len + 1, name, name_len + 1);
+
+	return batch->path;
+}
@@ -91,15 +91,12 @@ void
 ms_drm_unregister(const char* path)
 {
 	int ret;
-	ms_ignore_file_info *ignore_file;
 
 	ret = drm_process_request(DRM_REQUEST_TYPE_UNREGISTER_FILE, (void *)path, NULL);
 	if (ret != DRM_RETURN_SUCCESS)
 		MS_DBG_ERR("drm_process_request error : %d", ret);
 
-	ignore_file = ms_inoti_find_ignore_file(path);
-	if (ignore_file != NULL)
-		ms_inoti_delete_ignore_file(ignore_file);
+	ms_inoti_delete_ignore_file(path);
 }
 
 void
@@ -251,7 +251,7 @@ ms_mmc_removed_handler(void)
 	g_async_queue_push(scan_queue, GINT_TO_POINTER(mmc_scan_data));
 
 	/*remove added watch descriptors */
-	ms_inoti_remove_watch_recursive(MS_ROOT_PATH_EXTERNAL);
+	ms_inoti_detach_storage(MS_STORATE_EXTERNAL);
 
 	ms_inoti_delete_mmc_ignore_file();
 
@@ -283,9 +283,12 @@ ms_mmc_vconf_cb(void *data)
 		if (!ms_drm_insert_ext_memory())
 			MS_DBG_ERR("ms_drm_insert_ext_memory failed");
 
+		ms_inoti_attach_storage(MS_STORATE_EXTERNAL);
+
 		ms_make_default_path_mmc();
 
-		ms_inoti_add_watch_all_directory(MS_STORATE_EXTERNAL);
+		/*storage scan adds watches of sub directories while it reads them*/
+		ms_inoti_add_watch(MS_ROOT_PATH_EXTERNAL);
 
 		scan_data->path = strdup(MS_ROOT_PATH_EXTERNAL);
 		scan_data->scan_type = ms_get_mmc_state();
@@ -0,0 +1,538 @@
+/*
+ *  Media Server
+ *
+ * Copyright (c) 2000 - 2011 Samsung Electronics Co., Ltd. All rights reserved.
+ *
+ * Contact: Yong Yeon Kim <yy9875.kim@samsung.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * This file defines api utilities of contents manager engines.
+ *
+ * @file		media-server-fanotify.c
+ * @author	Yong Yeon Kim(yy9875.kim@samsung.com)
+ * @version	1.0
+ * @brief
+ */
+#include <sys/fanotify.h>
+
+#include "media-server-utils.h"
+#include "media-server-inotify-internal.h"
+#include "media-server-fanotify.h"
+
+#ifdef FAN_REPORT_DFID_NAME
+
+#define MS_FANOTI_FS_MAX 8
+#define MS_FANOTI_DIR_CACHE_MAX 256
+#define MS_FANOTI_DELETED " (deleted)"
+#define MS_FANOTI_OUTSIDE "" /*cached path of directory out of the storage*/
+
+typedef struct ms_fanoti_fs_info {
+	fsid_t fsid;
+	char *path;	/*path on this file system, it is opened to resolve file handles*/
+	int mount_fd;	/*opened only while reading events, not to block unmount*/
+} ms_fanoti_fs_info;
+
+/*each storage has its own fanotify group, events of a group are translated for its event loop*/
+typedef struct ms_fanoti_group_info {
+	const char *root;	/*events out of root are dropped*/
+	GMutex *mutex;	/*protects below, marks are added out of the event loop*/
+	ms_fanoti_fs_info fs[MS_FANOTI_FS_MAX];
+	int fs_count;
+	uint32_t cookie;	/*cookie of IN_MOVED_FROM and IN_MOVED_TO made by us*/
+	bool moved_from;	/*the last event was FAN_MOVED_FROM*/
+	int next_wd;	/*directories get wd in the watch registry when they have events*/
+	GHashTable *dir_cache;	/*file handle -> directory path*/
+	char buffer[INOTI_BUF_LEN];
+} ms_fanoti_group_info;
+
+static ms_fanoti_group_info fanoti_group[MS_INOTI_STORAGE_NUM];
+
+static bool fanoti_rename;	/*FAN_RENAME reports both names of rename in one event*/
+
+/*event types in the order they happen on one name*/
+static const struct {
+	uint64_t fan_mask;
+	uint32_t in_mask;
+} fanoti_mask_table[] = {
+	{FAN_CREATE, IN_CREATE},
+	{FAN_MOVED_TO, IN_MOVED_TO},
+	{FAN_CLOSE_WRITE, IN_CLOSE_WRITE},
+	{FAN_MOVED_FROM, IN_MOVED_FROM},
+	{FAN_DELETE, IN_DELETE},
+};
+
+#define FANOTI_MASK_NUM ((int)(sizeof(fanoti_mask_table)/sizeof(fanoti_mask_table[0])))
+
+static void _ms_fanoti_clear_group(ms_fanoti_group_info *group)
+{
+	int i;
+
+	for (i = 0; i < group->fs_count; i++) {
+		if (group->fs[i].mount_fd >= 0)
+			close(group->fs[i].mount_fd);
+		MS_SAFE_FREE(group->fs[i].path);
+	}
+	group->fs_count = 0;
+	group->moved_from = false;
+
+	g_hash_table_remove_all(group->dir_cache);
+}
+
+int ms_fanoti_init(ms_storage_type_t storage_type)
+{
+	int fd;
+	ms_fanoti_group_info *group = &fanoti_group[storage_type];
+
+	if (group->mutex == NULL) {
+		group->root = (storage_type == MS_STORAGE_INTERNAL) ? MS_ROOT_PATH_INTERNAL : MS_ROOT_PATH_EXTERNAL;
+		group->next_wd = 1;
+		group->mutex = g_mutex_new();
+		group->dir_cache = g_hash_table_new_full(g_str_hash, g_str_equal, free, free);
+		if (group->mutex == NULL || group->dir_cache == NULL) {
+			MS_DBG_ERR("fanotify group init fail");
+			return -1;
+		}
+	}
+
+	fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_REPORT_DFID_NAME, O_RDONLY | O_LARGEFILE);
+	if (fd < 0) {
+		MS_DBG("fanotify is not available : %s", strerror(errno));
+		return -1;
+	}
+
+#ifdef FAN_RENAME
+	fanoti_rename = true;
+#endif
+
+	/*file systems of the previous group are not marked in this one*/
+	ms_fanoti_clear(storage_type);
+
+	return fd;
+}
+
+void ms_fanoti_clear(ms_storage_type_t storage_type)
+{
+	ms_fanoti_group_info *group = &fanoti_group[storage_type];
+
+	if (group->mutex == NULL)
+		return;
+
+	g_mutex_lock(group->mutex);
+	_ms_fanoti_clear_group(group);
+	g_mutex_unlock(group->mutex);
+}
+
+static ms_fanoti_fs_info *_ms_fanoti_find_fs(ms_fanoti_group_info *group, const void *fsid)
+{
+	int i;
+
+	for (i = 0; i < group->fs_count; i++) {
+		if (memcmp(&group->fs[i].fsid, fsid, sizeof(fsid_t)) == 0)
+			return &group->fs[i];
+	}
+
+	return NULL;
+}
+
+/*forget file systems which are unmounted*/
+static void _ms_fanoti_clean_fs(ms_fanoti_group_info *group)
+{
+	int i = 0;
+	struct statfs st;
+
+	while (i < group->fs_count) {
+		if (statfs(group->fs[i].path, &st) == 0
+			&& memcmp(&group->fs[i].fsid, &st.f_fsid, sizeof(fsid_t)) == 0) {
+			i++;
+			continue;
+		}
+
+		MS_DBG("file system is gone : %s", group->fs[i].path);
+		if (group->fs[i].mount_fd >= 0)
+			close(group->fs[i].mount_fd);
+		MS_SAFE_FREE(group->fs[i].path);
+		group->fs[i] = group->fs[group->fs_count - 1];
+		group->fs_count--;
+	}
+}
+
+static int _ms_fanoti_mark(ms_fanoti_group_info *group, int fd, const char *path)
+{
+	int ret = -1;
+	uint64_t mask;
+	struct statfs st;
+	ms_fanoti_fs_info *fs;
+
+	if (statfs(path, &st) < 0) {
+		MS_DBG_ERR("statfs failed : %s [%s]", path, strerror(errno));
+		return MS_ERR_INVALID_DIR_PATH;
+	}
+
+	/*file system is already watched by this group*/
+	if (_ms_fanoti_find_fs(group, &st.f_fsid) != NULL)
+		return MS_ERR_NONE;
+
+	if (group->fs_count == MS_FANOTI_FS_MAX)
+		_ms_fanoti_clean_fs(group);
+
+	if (group->fs_count == MS_FANOTI_FS_MAX) {
+		MS_DBG_ERR("too many file systems : %s", path);
+		return MS_ERR_UNKNOWN_ERROR;
+	}
+
+	mask = FAN_CREATE | FAN_DELETE | FAN_CLOSE_WRITE | FAN_ONDIR;
+
+#ifdef FAN_RENAME
+	if (fanoti_rename) {
+		ret = fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask | FAN_RENAME, AT_FDCWD, path);
+		if (ret < 0 && errno == EINVAL) {
+			/*kernel is older than FAN_RENAME*/
+			fanoti_rename = false;
+		}
+	}
+#endif
+
+	if (!fanoti_rename)
+		ret = fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask | FAN_MOVED_FROM | FAN_MOVED_TO, AT_FDCWD, path);
+
+	if (ret < 0) {
+		MS_DBG_ERR("fanotify_mark failed : %s [%s]", path, strerror(errno));
+		return MS_ERR_UNKNOWN_ERROR;
+	}
+
+	fs = &group->fs[group->fs_count];
+	fs->path = strdup(path);
+	if (fs->path == NULL) {
+		MS_DBG_ERR("strdup fail");
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+	memcpy(&fs->fsid, &st.f_fsid, sizeof(fsid_t));
+	fs->mount_fd = -1;
+	group->fs_count++;
+
+	MS_DBG("add mark : %s", path);
+
+	return MS_ERR_NONE;
+}
+
+int ms_fanoti_mark(ms_storage_type_t storage_type, int fd, const char *path)
+{
+	int err;
+	ms_fanoti_group_info *group = &fanoti_group[storage_type];
+
+	g_mutex_lock(group->mutex);
+	err = _ms_fanoti_mark(group, fd, path);
+	g_mutex_unlock(group->mutex);
+
+	return err;
+}
+
+/*other files on the marked file system, like DB files, are not media of the storage*/
+static bool _ms_fanoti_is_media_path(ms_fanoti_group_info *group, const char *path)
+{
+	int len;
+
+	len = strlen(group->root);
+	if (strncmp(path, group->root, len) == 0 && (path[len] == '\0' || path[len] == '/'))
+		return true;
+
+	return (group == &fanoti_group[MS_STORAGE_INTERNAL] && strcmp(path, MS_DB_UPDATE_NOTI_PATH) == 0);
+}
+
+static bool _ms_fanoti_get_dir_path(ms_fanoti_group_info *group, struct fanotify_event_info_fid *fid, char *path, int size)
+{
+	int i;
+	int dir_fd;
+	int len;
+	char key[2 * (sizeof(fsid_t) + sizeof(int) + MAX_HANDLE_SZ) + 1];
+	char proc_path[32];
+	char *cached;
+	struct file_handle *handle = (struct file_handle *)fid->handle;
+	ms_fanoti_fs_info *fs;
+
+	if (handle->handle_bytes > MAX_HANDLE_SZ)
+		return false;
+
+	/*key is hex string of file system id and file handle*/
+	len = 0;
+	for (i = 0; i < sizeof(fsid_t); i++)
+		len += sprintf(key + len, "%02x", ((unsigned char *)&fid->fsid)[i]);
+	for (i = 0; i < sizeof(int); i++)
+		len += sprintf(key + len, "%02x", ((unsigned char *)&handle->handle_type)[i]);
+	for (i = 0; i < handle->handle_bytes; i++)
+		len += sprintf(key + len, "%02x", handle->f_handle[i]);
+
+	cached = g_hash_table_lookup(group->dir_cache, key);
+	if (cached != NULL) {
+		if (cached[0] == '\0')
+			return false;
+		return (ms_strcopy(path, size, "%s", cached) == MS_ERR_NONE);
+	}
+
+	fs = _ms_fanoti_find_fs(group, &fid->fsid);
+	if (fs == NULL)
+		return false;
+
+	if (fs->mount_fd < 0) {
+		fs->mount_fd = open(fs->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fs->mount_fd < 0) {
+			MS_DBG_ERR("open failed : %s [%s]", fs->path, strerror(errno));
+			return false;
+		}
+	}
+
+	dir_fd = open_by_handle_at(fs->mount_fd, handle, O_PATH | O_CLOEXEC);
+	if (dir_fd < 0) {
+		/*directory is already removed*/
+		return false;
+	}
+
+	snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", dir_fd);
+	len = readlink(proc_path, path, size - 1);
+	close(dir_fd);
+
+	if (len <= 0)
+		return false;
+	path[len] = '\0';
+
+	if (len > strlen(MS_FANOTI_DELETED)
+		&& strcmp(path + len - strlen(MS_FANOTI_DELETED), MS_FANOTI_DELETED) == 0)
+		return false;
+
+	if (g_hash_table_size(group->dir_cache) >= MS_FANOTI_DIR_CACHE_MAX)
+		g_hash_table_remove_all(group->dir_cache);
+
+	/*directory out of the storage is cached too, its next events are dropped at once*/
+	if (!_ms_fanoti_is_media_path(group, path)) {
+		g_hash_table_insert(group->dir_cache, strdup(key), strdup(MS_FANOTI_OUTSIDE));
+		return false;
+	}
+
+	g_hash_table_insert(group->dir_cache, strdup(key), strdup(path));
+
+	return true;
+}
+
+/*get wd of directory and name of entry, return false if the entry is not watched*/
+static bool _ms_fanoti_get_entry(ms_fanoti_group_info *group, struct fanotify_event_info_fid *fid, int *wd, const char **name)
+{
+	char dir_path[MS_FILE_PATH_LEN_MAX] = { 0 };
+	struct file_handle *handle = (struct file_handle *)fid->handle;
+	ms_storage_type_t storage_type = group - fanoti_group;
+
+	*name = (const char *)handle->f_handle + handle->handle_bytes;
+	if ((*name)[0] == '\0' || strcmp(*name, ".") == 0)
+		return false;
+
+	if (!_ms_fanoti_get_dir_path(group, fid, dir_path, sizeof(dir_path)))
+		return false;
+
+	*wd = _ms_inoti_get_watch_wd(dir_path);
+	if (*wd < 0) {
+		/*wd is unique only in the group like inotify*/
+		*wd = MS_INOTI_WD_KEY(storage_type, group->next_wd);
+		group->next_wd++;
+		if (_ms_inoti_insert_watch(*wd, dir_path) != MS_ERR_NONE)
+			return false;
+	}
+
+	return true;
+}
+
+/*return offset after the event, -1 if buffer is full*/
+static int _ms_fanoti_put_event(char *buffer, int size, int offset,
+				int wd, uint32_t mask, uint32_t cookie, const char *name)
+{
+	int len = 0;
+	struct inotify_event *event;
+
+	/*name is padded like inotify*/
+	if (name != NULL)
+		len = (strlen(name) + 1 + 3) & ~3;
+
+	if (offset + INOTI_EVENT_SIZE + len > size)
+		return -1;
+
+	event = (struct inotify_event *)(buffer + offset);
+	event->wd = wd;
+	event->mask = mask;
+	event->cookie = cookie;
+	event->len = len;
+	if (len > 0) {
+		memset(event->name, 0, len);
+		strcpy(event->name, name);
+	}
+
+	return offset + INOTI_EVENT_SIZE + len;
+}
+
+static int _ms_fanoti_put_metadata(ms_fanoti_group_info *group, char *buffer, int size, int offset,
+				struct fanotify_event_metadata *meta)
+{
+	int i;
+	int wd;
+	char *ptr;
+	const char *name;
+	uint32_t is_dir;
+	uint32_t cookie;
+	uint32_t cookie_from = 0;
+	uint32_t cookie_to = 0;
+	uint64_t mask = meta->mask & ~FAN_ONDIR;
+	struct fanotify_event_info_header *info;
+	struct fanotify_event_info_fid *fid = NULL;
+	struct fanotify_event_info_fid *old_fid = NULL;
+	struct fanotify_event_info_fid *new_fid = NULL;
+
+	if (meta->mask & FAN_Q_OVERFLOW)
+		return _ms_fanoti_put_event(buffer, size, offset, -1, IN_Q_OVERFLOW, 0, NULL);
+
+	for (ptr = (char *)(meta + 1); ptr < (char *)meta + meta->event_len; ptr += info->len) {
+		info = (struct fanotify_event_info_header *)ptr;
+		if (info->len == 0)
+			break;
+
+		if (info->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME)
+			fid = (struct fanotify_event_info_fid *)info;
+#ifdef FAN_RENAME
+		else if (info->info_type == FAN_EVENT_INFO_TYPE_OLD_DFID_NAME)
+			old_fid = (struct fanotify_event_info_fid *)info;
+		else if (info->info_type == FAN_EVENT_INFO_TYPE_NEW_DFID_NAME)
+			new_fid = (struct fanotify_event_info_fid *)info;
+#endif
+	}
+
+	is_dir = (meta->mask & FAN_ONDIR) ? IN_ISDIR : 0;
+
+	/*path of directory changes, cached paths of sub directories are wrong*/
+	if (is_dir && (meta->mask & ~(FAN_ONDIR | FAN_CREATE | FAN_CLOSE_WRITE)))
+		g_hash_table_remove_all(group->dir_cache);
+
+	if (old_fid != NULL || new_fid != NULL) {
+		/*FAN_RENAME : both names are known*/
+		group->moved_from = false;
+		cookie = ++group->cookie;
+		if (old_fid != NULL && _ms_fanoti_get_entry(group, old_fid, &wd, &name))
+			offset = _ms_fanoti_put_event(buffer, size, offset, wd, IN_MOVED_FROM | is_dir, cookie, name);
+		if (offset >= 0 && new_fid != NULL && _ms_fanoti_get_entry(group, new_fid, &wd, &name))
+			offset = _ms_fanoti_put_event(buffer, size, offset, wd, IN_MOVED_TO | is_dir, cookie, name);
+		return offset;
+	}
+
+	/*FAN_MOVED_FROM and FAN_MOVED_TO of one rename are queued in a row*/
+	if (mask & FAN_MOVED_TO)
+		cookie_to = group->moved_from ? group->cookie : ++group->cookie;
+	if (mask & FAN_MOVED_FROM)
+		cookie_from = ++group->cookie;
+	group->moved_from = (mask == FAN_MOVED_FROM);
+
+	if (fid == NULL || !_ms_fanoti_get_entry(group, fid, &wd, &name))
+		return offset;
+
+	for (i = 0; i < FANOTI_MASK_NUM && offset >= 0; i++) {
+		if (!(mask & fanoti_mask_table[i].fan_mask))
+			continue;
+
+		if (fanoti_mask_table[i].in_mask == IN_MOVED_TO)
+			cookie = cookie_to;
+		else if (fanoti_mask_table[i].in_mask == IN_MOVED_FROM)
+			cookie = cookie_from;
+		else
+			cookie = 0;
+
+		offset = _ms_fanoti_put_event(buffer, size, offset, wd,
+					fanoti_mask_table[i].in_mask | is_dir, cookie, name);
+	}
+
+	return offset;
+}
+
+int ms_fanoti_read(ms_storage_type_t storage_type, int fd, char *buffer, int size)
+{
+	int i;
+	int length;
+	int offset = 0;
+	int next;
+	int read_size;
+	struct fanotify_event_metadata *meta;
+	ms_fanoti_group_info *group = &fanoti_group[storage_type];
+
+	/*an event becomes at most FANOTI_MASK_NUM inotify events, each of them is not larger than the event itself.
+	  events which do not fit are left in the group for the next read*/
+	read_size = size / FANOTI_MASK_NUM;
+	if (read_size > sizeof(group->buffer))
+		read_size = sizeof(group->buffer);
+
+	g_mutex_lock(group->mutex);
+
+	length = read(fd, group->buffer, read_size);
+	if (length <= 0) {
+		g_mutex_unlock(group->mutex);
+		return length;
+	}
+
+	for (meta = (struct fanotify_event_metadata *)group->buffer;
+		FAN_EVENT_OK(meta, length); meta = FAN_EVENT_NEXT(meta, length)) {
+		if (meta->vers != FANOTIFY_METADATA_VERSION) {
+			MS_DBG_ERR("fanotify version mismatch : %d", meta->vers);
+			break;
+		}
+
+		if (meta->fd >= 0)
+			close(meta->fd);
+
+		next = _ms_fanoti_put_metadata(group, buffer, size, offset, meta);
+		if (next < 0) {
+			MS_DBG_ERR("translated events do not fit : %d", size);
+			break;
+		}
+		offset = next;
+	}
+
+	for (i = 0; i < group->fs_count; i++) {
+		if (group->fs[i].mount_fd >= 0) {
+			close(group->fs[i].mount_fd);
+			group->fs[i].mount_fd = -1;
+		}
+	}
+
+	g_mutex_unlock(group->mutex);
+
+	return offset;
+}
+
+#else /*FAN_REPORT_DFID_NAME*/
+
+int ms_fanoti_init(ms_storage_type_t storage_type)
+{
+	return -1;
+}
+
+void ms_fanoti_clear(ms_storage_type_t storage_type)
+{
+}
+
+int ms_fanoti_mark(ms_storage_type_t storage_type, int fd, const char *path)
+{
+	return MS_ERR_UNKNOWN_ERROR;
+}
+
+int ms_fanoti_read(ms_storage_type_t storage_type, int fd, char *buffer, int size)
+{
+	return -1;
+}
+
+#endif /*FAN_REPORT_DFID_NAME*/
@@ -30,87 +30,795 @@
 #include "media-server-utils.h"
 #include "media-server-inotify-internal.h"
 
-int inoti_fd;
-ms_create_file_info *latest_create_file;
-extern ms_inoti_dir_data *first_inoti_node;
+#define MS_CREATE_FILE_EXPIRE_TIME 600 /*sec*/
+#define MS_CREATE_FILE_COUNT_MAX 512
 
-int _ms_inoti_add_create_file_list(int wd, char *name)
+/*watch registry : watched directories are kept in a tree of interned path components.
+  a node knows only its parent and its own name, full path is made when it is needed.
+  children of a node are found through one edge table keyed by (parent, name)*/
+static ms_inoti_watch_info *watch_root;
+static GHashTable *watch_name_table;	/*name -> reference count*/
+static GHashTable *watch_edge_table;	/*(parent, name) -> ms_inoti_watch_info*/
+static GHashTable *watch_wd_table;	/*wd -> ms_inoti_watch_info*/
+static GMutex *watch_mutex;
+static int watch_count;
+static int watch_node_count;
+
+static const char *
+_ms_inoti_intern_name(const char *name)
 {
-	ms_create_file_info *new_node;
+	gpointer key;
+	gpointer value;
+	char *new_name;
 
-	new_node = malloc(sizeof(ms_create_file_info));
-	new_node->name = strdup(name);
-	new_node->wd = wd;
+	if (g_hash_table_lookup_extended(watch_name_table, name, &key, &value)) {
+		/*insert() frees the passed key if it exists, it is the interned name itself*/
+		g_hash_table_steal(watch_name_table, key);
+		g_hash_table_insert(watch_name_table, key, GINT_TO_POINTER(GPOINTER_TO_INT(value) + 1));
+		return key;
+	}
+
+	new_name = strdup(name);
+	if (new_name == NULL)
+		return NULL;
+
+	g_hash_table_insert(watch_name_table, new_name, GINT_TO_POINTER(1));
+
+	return new_name;
+}
+
+static void
+_ms_inoti_release_name(const char *name)
+{
+	gpointer value;
+	int ref;
 
-	/*first created file */
-	if (latest_create_file == NULL) {
-		latest_create_file = malloc(sizeof(ms_create_file_info));
-		new_node->previous = NULL;
+	value = g_hash_table_lookup(watch_name_table, name);
+	if (value == NULL)
+		return;
+
+	ref = GPOINTER_TO_INT(value) - 1;
+	if (ref == 0) {
+		g_hash_table_remove(watch_name_table, name);
 	} else {
-		latest_create_file->next = new_node;
-		new_node->previous = latest_create_file;
+		g_hash_table_steal(watch_name_table, name);
+		g_hash_table_insert(watch_name_table, (gpointer)name, GINT_TO_POINTER(ref));
+	}
+}
+
+static guint
+_ms_inoti_edge_hash(gconstpointer key)
+{
+	const ms_inoti_watch_info *node = key;
+
+	/*names are interned, so pointers are enough*/
+	return g_direct_hash(node->parent) * 31 + g_direct_hash(node->name);
+}
+
+static gboolean
+_ms_inoti_edge_equal(gconstpointer a, gconstpointer b)
+{
+	const ms_inoti_watch_info *node_a = a;
+	const ms_inoti_watch_info *node_b = b;
+
+	return (node_a->parent == node_b->parent && node_a->name == node_b->name);
+}
+
+static void
+_ms_inoti_link_node(ms_inoti_watch_info *node, ms_inoti_watch_info *parent)
+{
+	node->parent = parent;
+	node->prev_sibling = NULL;
+	node->next_sibling = parent->first_child;
+	if (parent->first_child != NULL)
+		parent->first_child->prev_sibling = node;
+	parent->first_child = node;
+
+	g_hash_table_insert(watch_edge_table, node, node);
+}
+
+static void
+_ms_inoti_unlink_node(ms_inoti_watch_info *node)
+{
+	if (node->parent == NULL)
+		return;
+
+	g_hash_table_remove(watch_edge_table, node);
+
+	if (node->prev_sibling != NULL)
+		node->prev_sibling->next_sibling = node->next_sibling;
+	else
+		node->parent->first_child = node->next_sibling;
+	if (node->next_sibling != NULL)
+		node->next_sibling->prev_sibling = node->prev_sibling;
+
+	node->parent = NULL;
+	node->prev_sibling = NULL;
+	node->next_sibling = NULL;
+}
+
+static ms_inoti_watch_info *
+_ms_inoti_new_watch_node(ms_inoti_watch_info *parent, const char *name)
+{
+	ms_inoti_watch_info *node;
+
+	node = malloc(sizeof(ms_inoti_watch_info));
+	if (node == NULL)
+		return NULL;
+
+	node->name = _ms_inoti_intern_name(name);
+	if (node->name == NULL) {
+		MS_SAFE_FREE(node);
+		return NULL;
+	}
+
+	node->wd = -1;
+	node->scan_epoch = 0;
+	node->parent = NULL;
+	node->first_child = NULL;
+	node->prev_sibling = NULL;
+	node->next_sibling = NULL;
+
+	if (parent != NULL)
+		_ms_inoti_link_node(node, parent);
+
+	watch_node_count++;
+
+	return node;
+}
+
+static ms_inoti_watch_info *
+_ms_inoti_find_child(ms_inoti_watch_info *parent, const char *name)
+{
+	gpointer interned;
+	ms_inoti_watch_info key;
+
+	/*if the name is not interned, there is no node which has it*/
+	if (!g_hash_table_lookup_extended(watch_name_table, name, &interned, NULL))
+		return NULL;
+
+	key.name = interned;
+	key.parent = parent;
+
+	return g_hash_table_lookup(watch_edge_table, &key);
+}
+
+static void
+_ms_inoti_unset_wd(ms_inoti_watch_info *node)
+{
+	if (node->wd < 0)
+		return;
+
+	/*wd table can point another node if kernel returned same wd for the new path*/
+	if (g_hash_table_lookup(watch_wd_table, GINT_TO_POINTER(node->wd)) == node)
+		g_hash_table_remove(watch_wd_table, GINT_TO_POINTER(node->wd));
+
+	node->wd = -1;
+	watch_count--;
+}
+
+/*caller has to unlink the node from its parent before*/
+static void
+_ms_inoti_free_subtree(ms_inoti_watch_info *node)
+{
+	ms_inoti_watch_info *child;
+	ms_inoti_watch_info *next;
+
+	for (child = node->first_child; child != NULL; child = next) {
+		next = child->next_sibling;
+		g_hash_table_remove(watch_edge_table, child);
+		_ms_inoti_free_subtree(child);
+	}
+
+	_ms_inoti_unset_wd(node);
+	_ms_inoti_release_name(node->name);
+	MS_SAFE_FREE(node);
+
+	watch_node_count--;
+}
+
+/*remove nodes which are not watched and have no child any more*/
+static void
+_ms_inoti_prune_node(ms_inoti_watch_info *node)
+{
+	ms_inoti_watch_info *parent;
+
+	while (node != NULL && node != watch_root && node->wd < 0 && node->first_child == NULL) {
+		parent = node->parent;
+		_ms_inoti_unlink_node(node);
+		_ms_inoti_free_subtree(node);
+		node = parent;
+	}
+}
+
+/*find node of path, if create is true, make nodes which are not exist*/
+static ms_inoti_watch_info *
+_ms_inoti_get_node_len(const char *path, int path_len, bool create)
+{
+	char name[MS_FILE_NAME_LEN_MAX + 1];
+	const char *pos = path;
+	const char *end = path + path_len;
+	const char *next;
+	int len;
+	ms_inoti_watch_info *node = watch_root;
+	ms_inoti_watch_info *child;
+
+	while (pos < end) {
+		next = memchr(pos, '/', end - pos);
+		if (next == NULL)
+			next = end;
+
+		len = next - pos;
+		if (len > MS_FILE_NAME_LEN_MAX)
+			return NULL;
+
+		if (len > 0) {
+			memcpy(name, pos, len);
+			name[len] = '\0';
+
+			child = _ms_inoti_find_child(node, name);
+			if (child == NULL) {
+				if (create == false)
+					return NULL;
+
+				child = _ms_inoti_new_watch_node(node, name);
+				if (child == NULL)
+					return NULL;
+			}
+			node = child;
+		}
+
+		pos = next + 1;
+	}
+
+	return node;
+}
+
+static ms_inoti_watch_info *
+_ms_inoti_get_node(const char *path, bool create)
+{
+	return _ms_inoti_get_node_len(path, strlen(path), create);
+}
+
+static int
+_ms_inoti_make_node_path(ms_inoti_watch_info *node, char *path, int sizeofpath)
+{
+	int len = 0;
+	int name_len;
+	ms_inoti_watch_info *cur;
+
+	for (cur = node; cur != watch_root; cur = cur->parent)
+		len += strlen(cur->name) + 1;
+
+	if (len + 1 > sizeofpath)
+		return MS_ERR_OUT_OF_RANGE;
+
+	/*fill from the end of path*/
+	path[len] = '\0';
+	for (cur = node; cur != watch_root; cur = cur->parent) {
+		name_len = strlen(cur->name);
+		len -= name_len;
+		memcpy(path + len, cur->name, name_len);
+		path[--len] = '/';
+	}
+
+	return MS_ERR_NONE;
+}
+
+static void
+_ms_inoti_walk_subtree(ms_inoti_watch_info *node, char *path, int path_len,
+			ms_inoti_watch_cb func, void *user_data)
+{
+	int len;
+	ms_inoti_watch_info *child;
+
+	if (node->wd >= 0)
+		func(path, node->wd, user_data);
+
+	for (child = node->first_child; child != NULL; child = child->next_sibling) {
+		len = strlen(child->name);
+		if (path_len + len + 2 > MS_FILE_PATH_LEN_MAX)
+			continue;
+
+		path[path_len] = '/';
+		memcpy(path + path_len + 1, child->name, len + 1);
+		_ms_inoti_walk_subtree(child, path, path_len + len + 1, func, user_data);
+		path[path_len] = '\0';
+	}
+}
+
+static void
+_ms_inoti_set_subtree_epoch(ms_inoti_watch_info *node, guint epoch)
+{
+	ms_inoti_watch_info *child;
+
+	node->scan_epoch = epoch;
+
+	for (child = node->first_child; child != NULL; child = child->next_sibling)
+		_ms_inoti_set_subtree_epoch(child, epoch);
+}
+
+int
+_ms_inoti_watch_table_init(void)
+{
+	if (watch_mutex == NULL)
+		watch_mutex = g_mutex_new();
+
+	if (watch_name_table == NULL)
+		watch_name_table = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+
+	if (watch_edge_table == NULL)
+		watch_edge_table = g_hash_table_new(_ms_inoti_edge_hash, _ms_inoti_edge_equal);
+
+	if (watch_wd_table == NULL)
+		watch_wd_table = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	if (watch_mutex == NULL || watch_name_table == NULL
+		|| watch_edge_table == NULL || watch_wd_table == NULL) {
+		MS_DBG_ERR("watch table init fail");
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+
+	/*root of tree is "/"*/
+	if (watch_root == NULL)
+		watch_root = _ms_inoti_new_watch_node(NULL, "");
+
+	if (watch_root == NULL) {
+		MS_DBG_ERR("watch root init fail");
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+
+	return MS_ERR_NONE;
+}
+
+bool
+_ms_inoti_watch_exist(const char *path)
+{
+	bool res;
+	ms_inoti_watch_info *node;
+
+	g_mutex_lock(watch_mutex);
+	node = _ms_inoti_get_node(path, false);
+	res = (node != NULL && node->wd >= 0);
+	g_mutex_unlock(watch_mutex);
+
+	return res;
+}
+
+int
+_ms_inoti_get_watch_wd(const char *path)
+{
+	int wd;
+	ms_inoti_watch_info *node;
+
+	g_mutex_lock(watch_mutex);
+	node = _ms_inoti_get_node(path, false);
+	wd = (node != NULL) ? node->wd : -1;
+	g_mutex_unlock(watch_mutex);
+
+	return wd;
+}
+
+int
+_ms_inoti_insert_watch(int wd, const char *path)
+{
+	ms_inoti_watch_info *node;
+
+	g_mutex_lock(watch_mutex);
+
+	node = _ms_inoti_get_node(path, true);
+	if (node == NULL) {
+		g_mutex_unlock(watch_mutex);
+		MS_DBG_ERR("fail to make watch node : %s", path);
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+
+	if (node->wd < 0) {
+		node->wd = wd;
+		watch_count++;
+		g_hash_table_replace(watch_wd_table, GINT_TO_POINTER(wd), node);
+	}
+
+	g_mutex_unlock(watch_mutex);
+
+	return MS_ERR_NONE;
+}
+
+int
+_ms_inoti_delete_watch(const char *path)
+{
+	ms_inoti_watch_info *node;
+
+	g_mutex_lock(watch_mutex);
+
+	node = _ms_inoti_get_node(path, false);
+	if (node == NULL || node->wd < 0) {
+		g_mutex_unlock(watch_mutex);
+		return MS_ERR_INVALID_DIR_PATH;
+	}
+
+	MS_DBG("find delete node: %s", path);
+	_ms_inoti_unset_wd(node);
+	_ms_inoti_prune_node(node);
+
+	g_mutex_unlock(watch_mutex);
+
+	return MS_ERR_NONE;
+}
+
+/*stamp is kept only on existing nodes, directories without watch do not need it*/
+void
+_ms_inoti_set_watch_epoch(const char *path, guint epoch, bool recursive)
+{
+	ms_inoti_watch_info *node;
+
+	g_mutex_lock(watch_mutex);
+
+	node = _ms_inoti_get_node(path, false);
+	if (node != NULL) {
+		if (recursive)
+			_ms_inoti_set_subtree_epoch(node, epoch);
+		else
+			node->scan_epoch = epoch;
+	}
+
+	g_mutex_unlock(watch_mutex);
+}
+
+guint
+_ms_inoti_get_watch_epoch(int wd)
+{
+	guint epoch;
+	ms_inoti_watch_info *node;
+
+	g_mutex_lock(watch_mutex);
+	node = g_hash_table_lookup(watch_wd_table, GINT_TO_POINTER(wd));
+	epoch = (node != NULL) ? node->scan_epoch : 0;
+	g_mutex_unlock(watch_mutex);
+
+	return epoch;
+}
+
+void
+_ms_inoti_delete_watch_recursive(const char *path)
+{
+	ms_inoti_watch_info *node;
+	ms_inoti_watch_info *parent;
+
+	g_mutex_lock(watch_mutex);
+
+	node = _ms_inoti_get_node(path, false);
+	if (node != NULL && node != watch_root) {
+		parent = node->parent;
+		_ms_inoti_unlink_node(node);
+		_ms_inoti_free_subtree(node);
+		_ms_inoti_prune_node(parent);
+	}
+
+	g_mutex_unlock(watch_mutex);
+}
+
+int
+_ms_inoti_rename_watch(const char *path_from, const char *path_to)
+{
+	const char *pos;
+	const char *name;
+	ms_inoti_watch_info *node;
+	ms_inoti_watch_info *old_parent;
+	ms_inoti_watch_info *new_parent;
+	ms_inoti_watch_info *target;
+
+	pos = strrchr(path_to, '/');
+	if (pos == NULL || pos[1] == '\0')
+		return MS_ERR_INVALID_DIR_PATH;
+
+	g_mutex_lock(watch_mutex);
+
+	node = _ms_inoti_get_node(path_from, false);
+	if (node == NULL || node == watch_root) {
+		g_mutex_unlock(watch_mutex);
+		return MS_ERR_INVALID_DIR_PATH;
+	}
+
+	new_parent = _ms_inoti_get_node_len(path_to, pos - path_to, true);
+
+	/*directory can not be moved into its own subtree*/
+	for (target = new_parent; target != NULL; target = target->parent) {
+		if (target == node)
+			break;
+	}
+	if (new_parent == NULL || target != NULL) {
+		g_mutex_unlock(watch_mutex);
+		return MS_ERR_INVALID_DIR_PATH;
+	}
+
+	/*node of destination is stale, the directory is replaced by renamed one*/
+	target = _ms_inoti_find_child(new_parent, pos + 1);
+	if (target == node) {
+		g_mutex_unlock(watch_mutex);
+		return MS_ERR_NONE;
+	}
+
+	if (target != NULL) {
+		_ms_inoti_unlink_node(target);
+		_ms_inoti_free_subtree(target);
+	}
+
+	name = _ms_inoti_intern_name(pos + 1);
+	if (name == NULL) {
+		g_mutex_unlock(watch_mutex);
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+
+	/*only the renamed node is changed, paths of children follow it*/
+	old_parent = node->parent;
+	_ms_inoti_unlink_node(node);
+	_ms_inoti_release_name(node->name);
+	node->name = name;
+	_ms_inoti_link_node(node, new_parent);
+
+	_ms_inoti_prune_node(old_parent);
+
+	g_mutex_unlock(watch_mutex);
+
+	return MS_ERR_NONE;
+}
+
+void
+_ms_inoti_foreach_watch(const char *path, ms_inoti_watch_cb func, void *user_data)
+{
+	char full_path[MS_FILE_PATH_LEN_MAX] = { 0 };
+	ms_inoti_watch_info *node;
+
+	g_mutex_lock(watch_mutex);
+
+	node = _ms_inoti_get_node(path, false);
+	if (node != NULL && _ms_inoti_make_node_path(node, full_path, sizeof(full_path)) == MS_ERR_NONE)
+		_ms_inoti_walk_subtree(node, full_path, strlen(full_path), func, user_data);
+
+	g_mutex_unlock(watch_mutex);
+}
+
+int
+_ms_inoti_get_watch_count(void)
+{
+	int count;
+
+	g_mutex_lock(watch_mutex);
+	count = watch_count;
+	g_mutex_unlock(watch_mutex);
+
+	return count;
+}
+
+int
+_ms_inoti_get_watch_node_count(void)
+{
+	int count;
+
+	g_mutex_lock(watch_mutex);
+	count = watch_node_count;
+	g_mutex_unlock(watch_mutex);
+
+	return count;
+}
+
+static guint
+_ms_inoti_create_file_hash(gconstpointer key)
+{
+	const ms_create_file_info *node = key;
+
+	return g_str_hash(node->name) * 31 + node->wd;
+}
+
+static gboolean
+_ms_inoti_create_file_equal(gconstpointer a, gconstpointer b)
+{
+	const ms_create_file_info *node_a = a;
+	const ms_create_file_info *node_b = b;
+
+	return (node_a->wd == node_b->wd && strcmp(node_a->name, node_b->name) == 0);
+}
+
+static void
+_ms_inoti_free_dropped_create_file(ms_inoti_shard_info *shard, ms_create_file_info *node)
+{
+	g_hash_table_remove(shard->create_file_drop_table, node);
+	g_queue_delete_link(shard->create_file_drop_queue, node->link);
+
+	MS_SAFE_FREE(node->name);
+	MS_SAFE_FREE(node);
+}
+
+/*drop old entries, files created by link or mknod and aborted writes never get CLOSE_WRITE*/
+static void
+_ms_inoti_expire_create_file_list(ms_inoti_shard_info *shard, gint64 now)
+{
+	ms_create_file_info *node;
+
+	while ((node = g_queue_peek_head(shard->create_file_queue)) != NULL) {
+		if (g_queue_get_length(shard->create_file_queue) <= MS_CREATE_FILE_COUNT_MAX
+			&& now - node->time < (gint64)MS_CREATE_FILE_EXPIRE_TIME * G_USEC_PER_SEC)
+			break;
+
+		MS_DBG("drop created file : [%d] %s", node->wd, node->name);
+
+		/*key is kept, CLOSE_WRITE of it checks DB*/
+		g_hash_table_remove(shard->create_file_table, node);
+		g_queue_delete_link(shard->create_file_queue, node->link);
+		g_queue_push_tail(shard->create_file_drop_queue, node);
+		node->link = g_queue_peek_tail_link(shard->create_file_drop_queue);
+		g_hash_table_insert(shard->create_file_drop_table, node, node);
+	}
+
+	while (g_queue_get_length(shard->create_file_drop_queue) > MS_CREATE_FILE_COUNT_MAX) {
+		node = g_queue_peek_head(shard->create_file_drop_queue);
+		_ms_inoti_free_dropped_create_file(shard, node);
 	}
-	new_node->next = NULL;
+}
+
+int _ms_inoti_create_file_init(ms_inoti_shard_info *shard)
+{
+	if (shard->create_file_table == NULL)
+		shard->create_file_table = g_hash_table_new(_ms_inoti_create_file_hash, _ms_inoti_create_file_equal);
+
+	if (shard->create_file_queue == NULL)
+		shard->create_file_queue = g_queue_new();
 
-	latest_create_file = new_node;
+	if (shard->create_file_drop_table == NULL)
+		shard->create_file_drop_table = g_hash_table_new(_ms_inoti_create_file_hash, _ms_inoti_create_file_equal);
+
+	if (shard->create_file_drop_queue == NULL)
+		shard->create_file_drop_queue = g_queue_new();
+
+	if (shard->create_file_table == NULL || shard->create_file_queue == NULL
+		|| shard->create_file_drop_table == NULL || shard->create_file_drop_queue == NULL) {
+		MS_DBG_ERR("create file table init fail");
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
 
 	return MS_ERR_NONE;
 }
 
-int _ms_inoti_delete_create_file_list(ms_create_file_info *node)
+int _ms_inoti_add_create_file_list(ms_inoti_shard_info *shard, int wd, char *name)
 {
-	if (node->previous != NULL)
-		node->previous->next = node->next;
-	if (node->next != NULL)
-		node->next->previous = node->previous;
+	gint64 now;
+	ms_create_file_info *new_node;
 
-	if (node == latest_create_file) {
-		latest_create_file = node->previous;
+	now = g_get_monotonic_time();
+
+	/*same file is created again, it becomes the latest one*/
+	new_node = _ms_inoti_find_create_file_list(shard, wd, name);
+	if (new_node != NULL) {
+		new_node->time = now;
+		g_queue_unlink(shard->create_file_queue, new_node->link);
+		g_queue_push_tail_link(shard->create_file_queue, new_node->link);
+		return MS_ERR_NONE;
+	}
+
+	/*dropped one is created again*/
+	_ms_inoti_take_dropped_create_file(shard, wd, name);
+
+	new_node = malloc(sizeof(ms_create_file_info));
+	if (new_node == NULL) {
+		MS_DBG_ERR("malloc fail");
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
 	}
 
+	new_node->name = strdup(name);
+	if (new_node->name == NULL) {
+		MS_DBG_ERR("strdup fail");
+		MS_SAFE_FREE(new_node);
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+	new_node->wd = wd;
+	new_node->time = now;
+
+	g_queue_push_tail(shard->create_file_queue, new_node);
+	new_node->link = g_queue_peek_tail_link(shard->create_file_queue);
+	g_hash_table_insert(shard->create_file_table, new_node, new_node);
+
+	_ms_inoti_expire_create_file_list(shard, now);
+
+	return MS_ERR_NONE;
+}
+
+int _ms_inoti_delete_create_file_list(ms_inoti_shard_info *shard, ms_create_file_info *node)
+{
+	g_hash_table_remove(shard->create_file_table, node);
+	g_queue_delete_link(shard->create_file_queue, node->link);
+
 	MS_SAFE_FREE(node->name);
 	MS_SAFE_FREE(node);
 
 	return MS_ERR_NONE;
 }
 
-ms_create_file_info *_ms_inoti_find_create_file_list(int wd, char *name)
+ms_create_file_info *_ms_inoti_find_create_file_list(ms_inoti_shard_info *shard, int wd, char *name)
 {
-	ms_create_file_info *node = NULL;
-	node = latest_create_file;
+	ms_create_file_info key;
 
-	while (node != NULL) {
-		if ((node->wd == wd) && (strcmp(node->name, name) == 0)) {
-			return node;
-		}
+	key.wd = wd;
+	key.name = name;
+
+	return g_hash_table_lookup(shard->create_file_table, &key);
+}
+
+void _ms_inoti_clear_create_file_list(ms_inoti_shard_info *shard)
+{
+	ms_create_file_info *node;
+
+	while ((node = g_queue_peek_head(shard->create_file_queue)) != NULL)
+		_ms_inoti_delete_create_file_list(shard, node);
+
+	while ((node = g_queue_peek_head(shard->create_file_drop_queue)) != NULL)
+		_ms_inoti_free_dropped_create_file(shard, node);
+}
+
+bool _ms_inoti_take_dropped_create_file(ms_inoti_shard_info *shard, int wd, char *name)
+{
+	ms_create_file_info key;
+	ms_create_file_info *node;
+
+	key.wd = wd;
+	key.name = name;
+
+	node = g_hash_table_lookup(shard->create_file_drop_table, &key);
+	if (node == NULL)
+		return false;
+
+	_ms_inoti_free_dropped_create_file(shard, node);
+
+	return true;
+}
+
+int _ms_inoti_get_create_file_count(ms_inoti_shard_info *shard)
+{
+	return g_hash_table_size(shard->create_file_table);
+}
 
-		node = node->previous;
+bool _ms_inoti_get_watch_path(int wd, char *path, int sizeofpath)
+{
+	int err;
+	ms_inoti_watch_info *node = NULL;
+
+	if (path == NULL)
+		return false;
+
+	g_mutex_lock(watch_mutex);
+
+	node = g_hash_table_lookup(watch_wd_table, GINT_TO_POINTER(wd));
+	if (node == NULL) {
+		g_mutex_unlock(watch_mutex);
+		MS_DBG_ERR("there is no watch for wd : %d", wd);
+		return false;
+	}
+
+	err = _ms_inoti_make_node_path(node, path, sizeofpath);
+
+	g_mutex_unlock(watch_mutex);
+
+	if (err != MS_ERR_NONE) {
+		MS_DBG_ERR("_ms_inoti_make_node_path error : %d", err);
+		return false;
 	}
 
-	return NULL;
+	return true;
 }
 
 bool _ms_inoti_get_full_path(int wd, char *name, char *path, int sizeofpath)
 {
 	int err;
-	ms_inoti_dir_data *node = NULL;
+	int len;
 
 	if (name == NULL || path == NULL)
 		return false;
 
-	if (first_inoti_node != NULL) {
-		node = first_inoti_node;
-		while (node->next != NULL) {
-			if (wd == node->wd) {
-				break;
-			}
-			node = node->next;
-		}
-	} else {
+	if (!_ms_inoti_get_watch_path(wd, path, sizeofpath))
 		return false;
-	}
 
-	err = ms_strappend(path, sizeofpath, "%s/%s", node->name, name);
+	len = strlen(path);
+	err = ms_strappend(path + len, sizeofpath - len, "%s%s", "/", name);
 	if (err != MS_ERR_NONE) {
 		MS_DBG_ERR("ms_strappend error : %d", err);
 		return false;
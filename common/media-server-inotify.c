@@ -27,476 +27,2329 @@
  * @version	1.0
  * @brief
  */
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <vconf.h>
 
 #include "media-server-utils.h"
 #include "media-server-db-svc.h"
+#include "media-server-dir-walk.h"
 #include "media-server-inotify-internal.h"
 #include "media-server-inotify.h"
+#include "media-server-fanotify.h"
+#include "media-server-scan.h"
 
 extern bool power_off;
-extern int inoti_fd;
 extern int mmc_state;
-ms_inoti_dir_data *first_inoti_node;
-ms_ignore_file_info *latest_ignore_file;
 
-int _ms_inoti_directory_scan_and_register_file(void **handle, char *dir_path)
+/*fd of each storage is its fanotify group, all directories of marked file systems are watched*/
+static bool fanoti_enabled;
+
+static ms_inoti_storage_info inoti_storage[MS_INOTI_STORAGE_NUM];
+
+#define MS_IGNORE_FILE_EXPIRE_TIME 60 /*sec*/
+#define MS_IGNORE_FILE_COUNT_MAX 1024
+
+/*ignore file set : hashed by path, queue keeps order of adding for expiry*/
+static GHashTable *ignore_file_table;	/*path -> ms_ignore_file_info*/
+static GQueue *ignore_file_queue;
+static GMutex *ignore_file_mutex;
+
+#define MS_MOVE_WAIT_TIME 500 /*msec, waiting time of IN_MOVED_TO after IN_MOVED_FROM*/
+
+
+#define MS_COALESCE_TIME_DEFAULT 200 /*msec, events of a file within this time are folded into one action*/
+#define MS_COALESCE_COUNT_MAX 512
+
+static int coalesce_time;	/*file actions wait for more events of same path for this time*/
+
+#define MS_TOMBSTONE_TIME_DEFAULT 2000 /*msec, deleted file which appears again within this time is refreshed*/
+
+static int tombstone_time;	/*delete actions wait for this time, atomic save of editors re-creates the file*/
+
+#define MS_BATCH_TIME 1000 /*msec, longest time of one bundle commit*/
+
+#define MS_INOTI_SHARD_MAX 4 /*file events are handled by this many threads per storage at most*/
+
+
+#define MS_WATCH_MAX_PATH "/proc/sys/fs/inotify/max_user_watches"
+#define MS_WATCH_BUDGET_RATIO 80 /*percent of max_user_watches used by media server*/
+#define MS_WATCH_RESERVE_RATIO 10 /*percent of budget kept for user directories and hot directories*/
+#define MS_WATCH_BUDGET_DEFAULT 8192
+#define MS_POLL_DIR_TIME 30 /*sec, interval of checking mtime of directories without watch*/
+
+/*directories over the watch budget are polled by mtime*/
+static int watch_budget;	/*protected by poll dir mutex*/
+static GHashTable *poll_dir_table;	/*path -> ms_poll_dir_info*/
+static GMutex *poll_dir_mutex;
+
+#define MS_ACTIVE_DIR_TIME 10 /*sec, directory is active for this time after its last event*/
+
+#define MS_HOT_DIR_EVENT_COUNT 500 /*events per second, directory over this is flooded*/
+#define MS_HOT_DIR_QUIET_TIME 2 /*sec, flooded directory is rescanned after this quiet time*/
+
+static guint scan_epoch_count;	/*last epoch given to a storage scan, touched only by the scan thread*/
+
+
+/*watch budget is lowered by any thread which hits ENOSPC*/
+static int _ms_inoti_get_watch_budget(void)
 {
-	struct dirent ent;
-	struct dirent *res = NULL;
-	DIR *dp = NULL;
-	char path[MS_FILE_PATH_LEN_MAX] = { 0 };
-	int err;
+	int budget;
 
-	if (dir_path == NULL)
-		return MS_ERR_INVALID_DIR_PATH;
+	g_mutex_lock(poll_dir_mutex);
+	budget = watch_budget;
+	g_mutex_unlock(poll_dir_mutex);
 
-	dp = opendir(dir_path);
-	if (dp == NULL) {
-		MS_DBG_ERR("Fail to open dir %s", dir_path);
-		return MS_ERR_DIR_OPEN_FAIL;
-	}
+	return budget;
+}
 
-	ms_inoti_add_watch(dir_path);
+static void _ms_inoti_set_watch_budget(int budget)
+{
+	g_mutex_lock(poll_dir_mutex);
+	watch_budget = budget;
+	g_mutex_unlock(poll_dir_mutex);
+}
 
-	while (!readdir_r(dp, &ent, &res)) {
-		if (res == NULL)
-			break;
+static ms_walk_result_t _ms_inoti_watch_new_dir(const char *path, void *user_data)
+{
+	ms_inoti_add_watch((char *)path);
+
+	return MS_WALK_CONTINUE;
+}
+
+typedef struct ms_rename_walk_data {
+	void **handle;
+	const char *org_path;
+	int chg_len;	/*length of new path of renamed directory*/
+	unsigned int plugins;	/*plugins which move each file*/
+} ms_rename_walk_data;
+
+static ms_walk_result_t _ms_inoti_move_renamed_file(ms_walk_batch *batch, void *user_data)
+{
+	int i;
+	int err;
+	const char *path_to;
+	char path_from[MS_FILE_PATH_LEN_MAX] = { 0 };
+	ms_storage_type_t src_storage = 0;
+	ms_storage_type_t des_storage = 0;
+	ms_rename_walk_data *data = user_data;
+
+	for (i = 0; i < batch->count; i++) {
+		if (batch->entries[i].type != DT_REG)
+			continue;
 
-		if (ent.d_name[0] == '.')
+		path_to = ms_walk_entry_path(batch, i);
+		if (path_to == NULL)
 			continue;
 
-		err = ms_strappend(path, sizeof(path), "%s/%s", dir_path, ent.d_name);
+		/*old path has same sub path under old directory*/
+		err = ms_strappend(path_from, sizeof(path_from), "%s%s", data->org_path, path_to + data->chg_len);
 		if (err != MS_ERR_NONE) {
 			MS_DBG_ERR("ms_strappend error : %d", err);
 			continue;
 		}
 
-		/*in case of directory */
-		if (ent.d_type == DT_DIR) {
-			_ms_inoti_directory_scan_and_register_file(handle, path);
-		} else {
-			err = ms_register_file(handle, path, NULL);
-			if (err != MS_ERR_NONE) {
-				MS_DBG_ERR("ms_register_file error : %d", err);
-				continue;
-			}
+		src_storage = ms_get_storage_type_by_full(path_from);
+		des_storage = ms_get_storage_type_by_full(path_to);
+
+		if ((src_storage != MS_ERR_INVALID_FILE_PATH)
+		    && (des_storage != MS_ERR_INVALID_FILE_PATH))
+			ms_move_item_by_plugins(data->handle, data->plugins, src_storage, des_storage, path_from, path_to);
+		else {
+			MS_DBG_ERR("src_storage : %d", src_storage);
+			MS_DBG_ERR("des_storage : %d", des_storage);
 		}
 	}
 
-	closedir(dp);
-
-	return 0;
+	return MS_WALK_CONTINUE;
 }
 
-int _ms_inoti_scan_renamed_folder(void **handle, char *org_path, char *chg_path)
+int _ms_inoti_scan_renamed_folder(void **handle, unsigned int plugins, char *org_path, char *chg_path)
 {
-	int err = -1;
-	struct dirent ent;
-	struct dirent *res = NULL;
-
-	DIR *dp = NULL;
-	char path_from[MS_FILE_PATH_LEN_MAX] = { 0 };
-	char path_to[MS_FILE_PATH_LEN_MAX] = { 0 };
-	ms_storage_type_t src_storage = 0;
-	ms_storage_type_t des_storage = 0;
+	ms_rename_walk_data data;
 
 	if (org_path == NULL || chg_path == NULL) {
 		MS_DBG_ERR("Parameter is wrong");
 		return MS_ERR_ARG_INVALID;
 	}
 
-	dp = opendir(chg_path);
-	if (dp == NULL) {
-		MS_DBG_ERR("Fail to open dir %s", chg_path);
-		return MS_ERR_DIR_OPEN_FAIL;
-	} else {
-		MS_DBG("Modify added watch");
-		ms_inoti_modify_watch(org_path, chg_path);
+	data.handle = handle;
+	data.org_path = org_path;
+	data.chg_len = strlen(chg_path);
+	data.plugins = plugins;
+
+	return ms_walk_dir(chg_path, NULL, _ms_inoti_move_renamed_file, &data);
+}
+
+/*rewrite paths under renamed directory, plugins without prefix rewrite move each file*/
+static void _ms_inoti_move_folder(void **handle, char *org_path, char *chg_path)
+{
+	int err;
+	unsigned int plugins = MS_PLUGIN_ALL;
+	ms_storage_type_t src_storage;
+	ms_storage_type_t des_storage;
+
+	if (ms_support_move_folder()) {
+		src_storage = ms_get_storage_type_by_full(org_path);
+		des_storage = ms_get_storage_type_by_full(chg_path);
+
+		if ((src_storage != MS_ERR_INVALID_FILE_PATH)
+		    && (des_storage != MS_ERR_INVALID_FILE_PATH)) {
+			err = ms_move_folder(handle, src_storage, des_storage, org_path, chg_path, &plugins);
+			if (err == MS_ERR_NONE)
+				return;
+
+			MS_DBG_ERR("ms_move_folder error : %d, plugins 0x%x move each file", err, plugins);
+		}
 	}
 
-	while (!readdir_r(dp, &ent, &res)) {
-		if (res == NULL)
+	/*enable bundle commit*/
+	ms_move_start(handle);
+
+	_ms_inoti_scan_renamed_folder(handle, plugins, org_path, chg_path);
+
+	/*disable bundle commit*/
+	ms_move_end(handle);
+}
+
+static void _ms_inoti_remove_ignore_file(ms_ignore_file_info *node)
+{
+	g_queue_delete_link(ignore_file_queue, node->link);
+	g_hash_table_remove(ignore_file_table, node->path);
+
+	MS_SAFE_FREE(node->path);
+	MS_SAFE_FREE(node);
+}
+
+/*remove old entries, the oldest one is the head of queue*/
+static void _ms_inoti_expire_ignore_file(gint64 now)
+{
+	ms_ignore_file_info *node;
+
+	while ((node = g_queue_peek_head(ignore_file_queue)) != NULL) {
+		if (g_queue_get_length(ignore_file_queue) <= MS_IGNORE_FILE_COUNT_MAX
+			&& now - node->time < (gint64)MS_IGNORE_FILE_EXPIRE_TIME * G_USEC_PER_SEC)
 			break;
 
-		if (ent.d_name[0] == '.')
-			continue;
+		MS_DBG("expire ignore file : %s", node->path);
+		_ms_inoti_remove_ignore_file(node);
+	}
+}
 
-		err = ms_strappend(path_from, sizeof(path_from), "%s/%s", org_path, ent.d_name);
-		if (err != MS_ERR_NONE) {
-			MS_DBG_ERR("ms_strappend error : %d", err);
-			continue;
-		}
+static int _ms_inoti_ignore_file_init(void)
+{
+	if (ignore_file_mutex == NULL)
+		ignore_file_mutex = g_mutex_new();
 
-		err =  ms_strappend(path_to, sizeof(path_to), "%s/%s", chg_path, ent.d_name);
-		if (err != MS_ERR_NONE) {
-			MS_DBG_ERR("ms_strappend error : %d", err);
-			continue;
+	if (ignore_file_table == NULL)
+		ignore_file_table = g_hash_table_new(g_str_hash, g_str_equal);
+
+	if (ignore_file_queue == NULL)
+		ignore_file_queue = g_queue_new();
+
+	if (ignore_file_mutex == NULL || ignore_file_table == NULL || ignore_file_queue == NULL) {
+		MS_DBG_ERR("ignore file set init fail");
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+
+	return MS_ERR_NONE;
+}
+
+int ms_inoti_add_ignore_file(const char *path)
+{
+	gint64 now;
+	ms_ignore_file_info *new_node;
+
+	now = g_get_monotonic_time();
+
+	g_mutex_lock(ignore_file_mutex);
+
+	/*same file is added again, it becomes the latest one*/
+	new_node = g_hash_table_lookup(ignore_file_table, path);
+	if (new_node != NULL) {
+		new_node->time = now;
+		g_queue_unlink(ignore_file_queue, new_node->link);
+		g_queue_push_tail_link(ignore_file_queue, new_node->link);
+		g_mutex_unlock(ignore_file_mutex);
+		return MS_ERR_NONE;
+	}
+
+	new_node = malloc(sizeof(ms_ignore_file_info));
+	if (new_node == NULL) {
+		g_mutex_unlock(ignore_file_mutex);
+		MS_DBG_ERR("malloc fail");
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+
+	new_node->path = strdup(path);
+	if (new_node->path == NULL) {
+		g_mutex_unlock(ignore_file_mutex);
+		MS_DBG_ERR("strdup fail");
+		MS_SAFE_FREE(new_node);
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+	new_node->time = now;
+
+	g_queue_push_tail(ignore_file_queue, new_node);
+	new_node->link = g_queue_peek_tail_link(ignore_file_queue);
+	g_hash_table_insert(ignore_file_table, new_node->path, new_node);
+
+	_ms_inoti_expire_ignore_file(now);
+
+	g_mutex_unlock(ignore_file_mutex);
+
+	return MS_ERR_NONE;
+}
+
+int ms_inoti_delete_ignore_file(const char *path)
+{
+	ms_ignore_file_info *node;
+
+	g_mutex_lock(ignore_file_mutex);
+
+	node = g_hash_table_lookup(ignore_file_table, path);
+	if (node == NULL) {
+		g_mutex_unlock(ignore_file_mutex);
+		return MS_ERR_FILE_NOT_FOUND;
+	}
+
+	_ms_inoti_remove_ignore_file(node);
+
+	g_mutex_unlock(ignore_file_mutex);
+
+	return MS_ERR_NONE;
+}
+
+bool ms_inoti_find_ignore_file(const char *path)
+{
+	bool res;
+
+	g_mutex_lock(ignore_file_mutex);
+
+	_ms_inoti_expire_ignore_file(g_get_monotonic_time());
+	res = (g_hash_table_lookup(ignore_file_table, path) != NULL);
+
+	g_mutex_unlock(ignore_file_mutex);
+
+	return res;
+}
+
+int ms_inoti_get_ignore_file_count(void)
+{
+	int count;
+
+	g_mutex_lock(ignore_file_mutex);
+	count = g_hash_table_size(ignore_file_table);
+	g_mutex_unlock(ignore_file_mutex);
+
+	return count;
+}
+
+void ms_inoti_delete_mmc_ignore_file(void)
+{
+	GList *cur;
+	GList *next;
+	ms_ignore_file_info *node;
+	int len = strlen(MS_ROOT_PATH_EXTERNAL);
+
+	g_mutex_lock(ignore_file_mutex);
+
+	for (cur = g_queue_peek_head_link(ignore_file_queue); cur != NULL; cur = next) {
+		next = cur->next;
+		node = cur->data;
+		if (strncmp(node->path, MS_ROOT_PATH_EXTERNAL, len) == 0)
+			_ms_inoti_remove_ignore_file(node);
+	}
+
+	g_mutex_unlock(ignore_file_mutex);
+
+	/*active flush */
+	malloc_trim(0);
+}
+
+static void _ms_inoti_print_stats(ms_inoti_storage_info *storage)
+{
+	MS_DBG("[%s] watch : %d/%d, polled dir : %d, watch node : %d, ignore file : %d, shard : %d",
+		storage->root, _ms_inoti_get_watch_count(), _ms_inoti_get_watch_budget(), ms_inoti_get_poll_dir_count(),
+		_ms_inoti_get_watch_node_count(),
+		ms_inoti_get_ignore_file_count(), storage->shard_count);
+}
+
+static void _ms_inoti_print_shard_stats(ms_inoti_shard_info *shard)
+{
+	MS_DBG("[%s:%d] created file : %d, coalesced file : %d",
+		shard->storage->root, shard->index, _ms_inoti_get_create_file_count(shard),
+		g_queue_get_length(shard->coalesce_queue) + g_queue_get_length(shard->tombstone_queue));
+}
+
+static int _ms_inoti_move_file_init(ms_inoti_storage_info *storage)
+{
+	if (storage->move_file_table == NULL)
+		storage->move_file_table = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	if (storage->move_file_queue == NULL)
+		storage->move_file_queue = g_queue_new();
+
+	if (storage->move_file_table == NULL || storage->move_file_queue == NULL) {
+		MS_DBG_ERR("move file table init fail");
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+
+	return MS_ERR_NONE;
+}
+
+static void _ms_inoti_free_move_file(ms_move_file_info *node)
+{
+	MS_SAFE_FREE(node->path);
+	MS_SAFE_FREE(node);
+}
+
+/*find IN_MOVED_FROM of cookie, the caller owns returned node*/
+static ms_move_file_info *_ms_inoti_take_move_file(ms_inoti_storage_info *storage, uint32_t cookie)
+{
+	ms_move_file_info *node;
+
+	node = g_hash_table_lookup(storage->move_file_table, GUINT_TO_POINTER(cookie));
+	if (node == NULL)
+		return NULL;
+
+	g_hash_table_remove(storage->move_file_table, GUINT_TO_POINTER(cookie));
+	g_queue_delete_link(storage->move_file_queue, node->link);
+
+	return node;
+}
+
+static int _ms_inoti_add_move_file(ms_inoti_storage_info *storage, uint32_t cookie, int wd, const char *path, bool is_dir)
+{
+	ms_move_file_info *node;
+
+	/*cookie is reused before the older IN_MOVED_FROM expires, it can not be paired any more*/
+	node = _ms_inoti_take_move_file(storage, cookie);
+	if (node != NULL) {
+		MS_DBG_ERR("cookie %u is reused : %s", cookie, node->path);
+		_ms_inoti_free_move_file(node);
+	}
+
+	node = malloc(sizeof(ms_move_file_info));
+	if (node == NULL) {
+		MS_DBG_ERR("malloc fail");
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+
+	node->path = strdup(path);
+	if (node->path == NULL) {
+		MS_DBG_ERR("strdup fail");
+		MS_SAFE_FREE(node);
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+	node->wd = wd;
+	node->cookie = cookie;
+	node->is_dir = is_dir;
+	node->time = g_get_monotonic_time();
+
+	g_queue_push_tail(storage->move_file_queue, node);
+	node->link = g_queue_peek_tail_link(storage->move_file_queue);
+	g_hash_table_insert(storage->move_file_table, GUINT_TO_POINTER(cookie), node);
+
+	return MS_ERR_NONE;
+}
+
+/*msec until the oldest IN_MOVED_FROM expires, -1 if nothing is waiting*/
+static int _ms_inoti_get_move_file_timeout(ms_inoti_storage_info *storage)
+{
+	gint64 remain;
+	ms_move_file_info *node;
+
+	node = g_queue_peek_head(storage->move_file_queue);
+	if (node == NULL)
+		return -1;
+
+	remain = node->time + (gint64)MS_MOVE_WAIT_TIME * 1000 - g_get_monotonic_time();
+	if (remain < 0)
+		return 0;
+
+	return (int)(remain / 1000) + 1;
+}
+
+static void _ms_inoti_move_file(ms_inoti_shard_info *shard, const char *path_from, const char *path_to)
+{
+	int err;
+	ms_storage_type_t src_storage;
+	ms_storage_type_t des_storage;
+
+	src_storage = ms_get_storage_type_by_full(path_from);
+	des_storage = ms_get_storage_type_by_full(path_to);
+
+	if ((src_storage != MS_ERR_INVALID_FILE_PATH)
+	    && (des_storage != MS_ERR_INVALID_FILE_PATH)) {
+		err = ms_move_item(shard->handle, src_storage, des_storage, path_from, path_to);
+		if (err == MS_ERR_NONE)
+			return;
+
+		MS_DBG_ERR("ms_move_item error : %d", err);
+	}
+
+	/*source was not in DB*/
+	err = ms_register_file(shard->handle, path_to, false);
+	if (err != MS_ERR_NONE) {
+		MS_DBG_ERR("ms_register_file error : %d", err);
+	}
+}
+
+static int _ms_inoti_batch_init(ms_inoti_shard_info *shard)
+{
+	if (shard->batch_path_table == NULL)
+		shard->batch_path_table = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+
+	if (shard->batch_path_table == NULL) {
+		MS_DBG_ERR("batch table init fail");
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+
+	return MS_ERR_NONE;
+}
+
+static void _ms_inoti_end_batch(ms_inoti_shard_info *shard)
+{
+	if (shard->batch_start_time == 0)
+		return;
+
+	MS_DBG("commit bundle : %d", g_hash_table_size(shard->batch_path_table));
+
+	ms_batch_end(shard->handle);
+	g_hash_table_remove_all(shard->batch_path_table);
+	shard->batch_start_time = 0;
+}
+
+static void _ms_inoti_add_batch_path(ms_inoti_shard_info *shard, const char *path)
+{
+	char *key;
+
+	key = strdup(path);
+	if (key == NULL) {
+		MS_DBG_ERR("strdup fail");
+		return;
+	}
+
+	g_hash_table_insert(shard->batch_path_table, key, key);
+}
+
+/*start bundle for writing the paths, path_from may be NULL*/
+static void _ms_inoti_prepare_batch(ms_inoti_shard_info *shard, const char *path, const char *path_from)
+{
+	/*previous writing of same path has to be committed first*/
+	if (g_hash_table_lookup(shard->batch_path_table, path) != NULL
+		|| (path_from != NULL && g_hash_table_lookup(shard->batch_path_table, path_from) != NULL))
+		_ms_inoti_end_batch(shard);
+
+	if (shard->batch_start_time == 0) {
+		ms_batch_start(shard->handle);
+		shard->batch_start_time = g_get_monotonic_time();
+	}
+
+	_ms_inoti_add_batch_path(shard, path);
+	if (path_from != NULL)
+		_ms_inoti_add_batch_path(shard, path_from);
+}
+
+/*commit bundle on idle or when it is held too long*/
+static void _ms_inoti_check_batch(ms_inoti_shard_info *shard)
+{
+	if (shard->batch_start_time == 0)
+		return;
+
+	if (g_get_monotonic_time() - shard->batch_start_time < (gint64)MS_BATCH_TIME * 1000) {
+		if (g_async_queue_length(shard->queue) > 0)
+			return;
+	}
+
+	_ms_inoti_end_batch(shard);
+}
+
+static int _ms_inoti_coalesce_init(ms_inoti_shard_info *shard)
+{
+	if (!ms_config_get_int(MS_COALESCE_TIME_KEY, &coalesce_time) || coalesce_time < 0)
+		coalesce_time = MS_COALESCE_TIME_DEFAULT;
+
+	if (!ms_config_get_int(MS_TOMBSTONE_TIME_KEY, &tombstone_time) || tombstone_time < 0)
+		tombstone_time = MS_TOMBSTONE_TIME_DEFAULT;
+	if (tombstone_time < coalesce_time)
+		tombstone_time = coalesce_time;
+
+	MS_DBG("coalescing time : %d msec, tombstone time : %d msec", coalesce_time, tombstone_time);
+
+	if (shard->coalesce_table == NULL)
+		shard->coalesce_table = g_hash_table_new(g_str_hash, g_str_equal);
+
+	if (shard->coalesce_queue == NULL)
+		shard->coalesce_queue = g_queue_new();
+
+	if (shard->tombstone_queue == NULL)
+		shard->tombstone_queue = g_queue_new();
+
+	if (shard->coalesce_table == NULL || shard->coalesce_queue == NULL || shard->tombstone_queue == NULL) {
+		MS_DBG_ERR("coalesce table init fail");
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+
+	return MS_ERR_NONE;
+}
+
+/*delete actions are kept in their own queue, each queue is in order of deadline*/
+static GQueue *_ms_inoti_get_coalesce_queue(ms_inoti_shard_info *shard, ms_coalesce_info *node)
+{
+	return node->tombstone ? shard->tombstone_queue : shard->coalesce_queue;
+}
+
+/*change action of node, deadline starts again when it moves to the other queue*/
+static void _ms_inoti_set_coalesce_action(ms_inoti_shard_info *shard, ms_coalesce_info *node, ms_inoti_action_t action)
+{
+	bool tombstone = (action == MS_INOTI_ACTION_DELETE);
+
+	node->action = action;
+	if (node->tombstone == tombstone)
+		return;
+
+	g_queue_unlink(_ms_inoti_get_coalesce_queue(shard, node), node->link);
+	node->tombstone = tombstone;
+	node->deadline = g_get_monotonic_time() + (gint64)(tombstone ? tombstone_time : coalesce_time) * 1000;
+	g_queue_push_tail_link(_ms_inoti_get_coalesce_queue(shard, node), node->link);
+}
+
+static void _ms_inoti_remove_coalesce(ms_inoti_shard_info *shard, ms_coalesce_info *node)
+{
+	g_hash_table_remove(shard->coalesce_table, node->path);
+	g_queue_delete_link(_ms_inoti_get_coalesce_queue(shard, node), node->link);
+
+	MS_SAFE_FREE(node->path);
+	MS_SAFE_FREE(node->path_from);
+	MS_SAFE_FREE(node);
+}
+
+static void _ms_inoti_run_coalesce(ms_inoti_shard_info *shard, ms_coalesce_info *node)
+{
+	int err = MS_ERR_NONE;
+
+	_ms_inoti_prepare_batch(shard, node->path, node->path_from);
+
+	switch (node->action) {
+	case MS_INOTI_ACTION_INSERT:
+		if (ms_check_exist(shard->handle, node->path) == MS_ERR_NONE) {
+			/*file is replaced, the record is kept*/
+			err = ms_refresh_item(shard->handle, node->path);
+			break;
 		}
+		err = ms_register_file_batch(shard->handle, node->path);
+		break;
+	case MS_INOTI_ACTION_REFRESH:
+		err = ms_refresh_item(shard->handle, node->path);
+		break;
+	case MS_INOTI_ACTION_MOVE:
+		if (ms_check_exist(shard->handle, node->path) == MS_ERR_NONE) {
+			/*renamed over existing file, the record of target is kept and refreshed*/
+			err = ms_delete_item(shard->handle, node->path_from);
+			if (err != MS_ERR_NONE)
+				MS_DBG_ERR("ms_delete_item error : %d", err);
+			err = ms_refresh_item(shard->handle, node->path);
+			break;
+		}
+		_ms_inoti_move_file(shard, node->path_from, node->path);
+		if (node->refresh) {
+			/*refresh needs the moved record*/
+			_ms_inoti_end_batch(shard);
+			err = ms_refresh_item(shard->handle, node->path);
+		}
+		break;
+	case MS_INOTI_ACTION_DELETE:
+		err = ms_delete_item(shard->handle, node->path);
+		break;
+	}
+
+	if (err != MS_ERR_NONE)
+		MS_DBG_ERR("action %d error : %d [%s]", node->action, err, node->path);
+
+	_ms_inoti_remove_coalesce(shard, node);
+}
+
+static void _ms_inoti_flush_coalesce_queue(ms_inoti_shard_info *shard, GQueue *queue, bool all)
+{
+	gint64 now;
+	ms_coalesce_info *node;
+
+	now = g_get_monotonic_time();
+
+	while ((node = g_queue_peek_head(queue)) != NULL) {
+		if (!all && node->deadline > now
+			&& g_queue_get_length(queue) <= MS_COALESCE_COUNT_MAX)
+			break;
+
+		_ms_inoti_run_coalesce(shard, node);
+	}
+}
+
+static void _ms_inoti_flush_coalesce(ms_inoti_shard_info *shard, bool all)
+{
+	_ms_inoti_flush_coalesce_queue(shard, shard->tombstone_queue, all);
+	_ms_inoti_flush_coalesce_queue(shard, shard->coalesce_queue, all);
+}
+
+/*run all waiting actions and commit them*/
+static void _ms_inoti_flush_all(ms_inoti_shard_info *shard)
+{
+	_ms_inoti_flush_coalesce(shard, true);
+	_ms_inoti_end_batch(shard);
+}
+
+/*msec until the oldest action runs, -1 if nothing is waiting*/
+static int _ms_inoti_get_coalesce_timeout(ms_inoti_shard_info *shard)
+{
+	gint64 remain;
+	ms_coalesce_info *node;
+	ms_coalesce_info *tombstone;
+
+	node = g_queue_peek_head(shard->coalesce_queue);
+	tombstone = g_queue_peek_head(shard->tombstone_queue);
+	if (node == NULL || (tombstone != NULL && tombstone->deadline < node->deadline))
+		node = tombstone;
+
+	if (node == NULL)
+		return -1;
+
+	remain = node->deadline - g_get_monotonic_time();
+	if (remain < 0)
+		return 0;
+
+	return (int)(remain / 1000) + 1;
+}
+
+static ms_coalesce_info *_ms_inoti_new_coalesce(ms_inoti_shard_info *shard, const char *path, ms_inoti_action_t action)
+{
+	ms_coalesce_info *node;
+
+	node = malloc(sizeof(ms_coalesce_info));
+	if (node == NULL) {
+		MS_DBG_ERR("malloc fail");
+		return NULL;
+	}
+
+	node->path = strdup(path);
+	if (node->path == NULL) {
+		MS_DBG_ERR("strdup fail");
+		MS_SAFE_FREE(node);
+		return NULL;
+	}
+	node->path_from = NULL;
+	node->action = action;
+	node->refresh = false;
+	node->tombstone = (action == MS_INOTI_ACTION_DELETE);
+	node->deadline = g_get_monotonic_time() + (gint64)(node->tombstone ? tombstone_time : coalesce_time) * 1000;
+
+	g_queue_push_tail(_ms_inoti_get_coalesce_queue(shard, node), node);
+	node->link = g_queue_peek_tail_link(_ms_inoti_get_coalesce_queue(shard, node));
+	g_hash_table_insert(shard->coalesce_table, node->path, node);
+
+	return node;
+}
+
+/*a new file appears on path*/
+static void _ms_inoti_coalesce_insert(ms_inoti_shard_info *shard, const char *path)
+{
+	ms_coalesce_info *node;
+
+	node = g_hash_table_lookup(shard->coalesce_table, path);
+	if (node == NULL) {
+		_ms_inoti_new_coalesce(shard, path, MS_INOTI_ACTION_INSERT);
+		return;
+	}
+
+	if (node->action == MS_INOTI_ACTION_DELETE) {
+		/*deleted and created again, the record is kept*/
+		_ms_inoti_set_coalesce_action(shard, node, MS_INOTI_ACTION_REFRESH);
+	} else if (node->action == MS_INOTI_ACTION_MOVE) {
+		node->refresh = true;
+	}
+}
+
+/*contents of file on path are changed*/
+static void _ms_inoti_coalesce_refresh(ms_inoti_shard_info *shard, const char *path)
+{
+	ms_coalesce_info *node;
+
+	node = g_hash_table_lookup(shard->coalesce_table, path);
+	if (node == NULL) {
+		_ms_inoti_new_coalesce(shard, path, MS_INOTI_ACTION_REFRESH);
+		return;
+	}
+
+	if (node->action == MS_INOTI_ACTION_DELETE) {
+		_ms_inoti_set_coalesce_action(shard, node, MS_INOTI_ACTION_REFRESH);
+	} else if (node->action == MS_INOTI_ACTION_MOVE) {
+		node->refresh = true;
+	}
+}
+
+/*file on path is removed*/
+static void _ms_inoti_coalesce_delete(ms_inoti_shard_info *shard, const char *path)
+{
+	int err;
+	ms_coalesce_info *node;
+
+	node = g_hash_table_lookup(shard->coalesce_table, path);
+	if (node == NULL) {
+		_ms_inoti_new_coalesce(shard, path, MS_INOTI_ACTION_DELETE);
+		return;
+	}
+
+	switch (node->action) {
+	case MS_INOTI_ACTION_INSERT:
+		/*created and deleted, nothing to do*/
+		_ms_inoti_remove_coalesce(shard, node);
+		break;
+	case MS_INOTI_ACTION_REFRESH:
+		_ms_inoti_set_coalesce_action(shard, node, MS_INOTI_ACTION_DELETE);
+		break;
+	case MS_INOTI_ACTION_MOVE:
+		/*the record is still on original path*/
+		_ms_inoti_prepare_batch(shard, node->path_from, NULL);
+		err = ms_delete_item(shard->handle, node->path_from);
+		if (err != MS_ERR_NONE)
+			MS_DBG_ERR("ms_delete_item error : %d", err);
+		_ms_inoti_remove_coalesce(shard, node);
+		break;
+	case MS_INOTI_ACTION_DELETE:
+		break;
+	}
+}
+
+/*file is renamed from path_from to path_to*/
+static void _ms_inoti_coalesce_move(ms_inoti_shard_info *shard, const char *path_from, const char *path_to)
+{
+	ms_coalesce_info *node;
+	char *path;
+
+	/*file on path_to is replaced, the move refreshes the record of path_to if it is in DB*/
+	node = g_hash_table_lookup(shard->coalesce_table, path_to);
+	if (node != NULL) {
+		if (node->action == MS_INOTI_ACTION_MOVE)
+			_ms_inoti_run_coalesce(shard, node);
+		else
+			_ms_inoti_remove_coalesce(shard, node);
+	}
+
+	node = g_hash_table_lookup(shard->coalesce_table, path_from);
+	if (node != NULL && node->action == MS_INOTI_ACTION_DELETE) {
+		_ms_inoti_run_coalesce(shard, node);
+		node = NULL;
+	}
+
+	if (node == NULL) {
+		node = _ms_inoti_new_coalesce(shard, path_to, MS_INOTI_ACTION_MOVE);
+		if (node != NULL) {
+			node->path_from = strdup(path_from);
+			if (node->path_from == NULL) {
+				MS_DBG_ERR("strdup fail");
+				node->action = MS_INOTI_ACTION_INSERT;
+			}
+		}
+		return;
+	}
+
+	/*follow the file to new path, deadline is kept*/
+	path = strdup(path_to);
+	if (path == NULL) {
+		MS_DBG_ERR("strdup fail");
+		_ms_inoti_run_coalesce(shard, node);
+		return;
+	}
+
+	g_hash_table_remove(shard->coalesce_table, node->path);
+
+	if (node->action == MS_INOTI_ACTION_REFRESH) {
+		node->action = MS_INOTI_ACTION_MOVE;
+		node->refresh = true;
+		node->path_from = node->path;
+	} else {
+		if (node->action == MS_INOTI_ACTION_MOVE && strcmp(node->path_from, path_to) == 0) {
+			/*moved back to original path*/
+			node->action = MS_INOTI_ACTION_REFRESH;
+			MS_SAFE_FREE(node->path_from);
+		}
+		MS_SAFE_FREE(node->path);
+	}
+
+	node->path = path;
+	g_hash_table_insert(shard->coalesce_table, node->path, node);
+
+	if (node->action == MS_INOTI_ACTION_REFRESH && !node->refresh)
+		_ms_inoti_remove_coalesce(shard, node);
+}
+
+/*directory of wd is handled by one shard, so events of a directory keep their order*/
+static ms_inoti_shard_info *_ms_inoti_get_shard(ms_inoti_storage_info *storage, int wd)
+{
+	return &storage->shards[((guint)wd * 2654435761u) % storage->shard_count];
+}
+
+static void _ms_inoti_free_job(ms_inoti_job_info *job)
+{
+	MS_SAFE_FREE(job->name);
+	MS_SAFE_FREE(job->path);
+	MS_SAFE_FREE(job->path_from);
+	MS_SAFE_FREE(job);
+}
+
+/*name, path and path_from may be NULL*/
+static ms_inoti_job_info *_ms_inoti_new_job(ms_inoti_job_t type, int wd,
+				const char *name, const char *path, const char *path_from)
+{
+	ms_inoti_job_info *job;
+
+	job = calloc(1, sizeof(ms_inoti_job_info));
+	if (job == NULL) {
+		MS_DBG_ERR("calloc fail");
+		return NULL;
+	}
+
+	job->type = type;
+	job->wd = wd;
+	if ((name != NULL && (job->name = strdup(name)) == NULL)
+		|| (path != NULL && (job->path = strdup(path)) == NULL)
+		|| (path_from != NULL && (job->path_from = strdup(path_from)) == NULL)) {
+		MS_DBG_ERR("strdup fail");
+		_ms_inoti_free_job(job);
+		return NULL;
+	}
+
+	return job;
+}
+
+/*job is kept in pending list of shard until _ms_inoti_dispatch_jobs()*/
+static void _ms_inoti_add_job(ms_inoti_shard_info *shard, ms_inoti_job_t type, int wd,
+				const char *name, const char *path, const char *path_from)
+{
+	ms_inoti_job_info *job;
+
+	job = _ms_inoti_new_job(type, wd, name, path, path_from);
+	if (job != NULL)
+		g_queue_push_tail(shard->pending, job);
+}
+
+/*jobs of one read are pushed at once, shard keeps its bundle while the queue is not empty*/
+static void _ms_inoti_dispatch_jobs(ms_inoti_storage_info *storage)
+{
+	int i;
+	ms_inoti_job_info *job;
+	ms_inoti_shard_info *shard;
+
+	for (i = 0; i < storage->shard_count; i++) {
+		shard = &storage->shards[i];
+		if (g_queue_is_empty(shard->pending))
+			continue;
+
+		g_async_queue_lock(shard->queue);
+		while ((job = g_queue_pop_head(shard->pending)) != NULL)
+			g_async_queue_push_unlocked(shard->queue, job);
+		g_async_queue_unlock(shard->queue);
+	}
+}
+
+/*send control job to shards marked in targets, or to all shards if targets is NULL, and wait until they finish it*/
+static void _ms_inoti_sync_shards(ms_inoti_storage_info *storage, const bool *targets, ms_inoti_job_t type)
+{
+	int i;
+	int count = 0;
+
+	for (i = 0; i < storage->shard_count; i++) {
+		if (targets == NULL || targets[i]) {
+			_ms_inoti_add_job(&storage->shards[i], type, -1, NULL, NULL, NULL);
+			count++;
+		}
+	}
+
+	if (count == 0)
+		return;
+
+	g_mutex_lock(storage->fence_mutex);
+	storage->fence_count = count;
+	g_mutex_unlock(storage->fence_mutex);
+
+	_ms_inoti_dispatch_jobs(storage);
+
+	g_mutex_lock(storage->fence_mutex);
+	while (storage->fence_count > 0)
+		g_cond_wait(storage->fence_cond, storage->fence_mutex);
+	g_mutex_unlock(storage->fence_mutex);
+}
+
+/*file actions of shard are in DB after this*/
+static void _ms_inoti_fence_shard(ms_inoti_storage_info *storage, ms_inoti_shard_info *shard)
+{
+	bool targets[MS_INOTI_SHARD_MAX] = { false };
+
+	targets[shard->index] = true;
+	_ms_inoti_sync_shards(storage, targets, MS_INOTI_JOB_FENCE);
+}
+
+typedef struct ms_fence_dir_data {
+	ms_inoti_storage_info *storage;
+	bool targets[MS_INOTI_SHARD_MAX];
+} ms_fence_dir_data;
+
+/*called with watch registry locked, only picks the shard*/
+static void _ms_inoti_mark_shard(const char *path, int wd, void *user_data)
+{
+	ms_fence_dir_data *data = user_data;
+
+	data->targets[_ms_inoti_get_shard(data->storage, wd)->index] = true;
+}
+
+/*file actions under directory on path, which is in directory of wd, are in DB after this*/
+static void _ms_inoti_fence_dir(ms_inoti_storage_info *storage, int wd, const char *path)
+{
+	ms_fence_dir_data data;
+
+	memset(&data, 0, sizeof(data));
+	data.storage = storage;
+	/*shard of parent directory may have a walk of this directory*/
+	data.targets[_ms_inoti_get_shard(storage, wd)->index] = true;
+	_ms_inoti_foreach_watch(path, _ms_inoti_mark_shard, &data);
+
+	_ms_inoti_sync_shards(storage, data.targets, MS_INOTI_JOB_FENCE);
+}
+
+static void _ms_inoti_done_sync(ms_inoti_shard_info *shard)
+{
+	ms_inoti_storage_info *storage = shard->storage;
+
+	g_mutex_lock(storage->fence_mutex);
+	storage->fence_count--;
+	g_cond_signal(storage->fence_cond);
+	g_mutex_unlock(storage->fence_mutex);
+}
+
+static void _ms_inoti_close_write(ms_inoti_shard_info *shard, ms_inoti_job_info *job)
+{
+	ms_create_file_info *node;
+
+	node = _ms_inoti_find_create_file_list(shard, job->wd, job->name);
+	if (node != NULL) {
+		_ms_inoti_coalesce_insert(shard, job->path);
+		_ms_inoti_delete_create_file_list(shard, node);
+	}
+	else if (_ms_inoti_take_dropped_create_file(shard, job->wd, job->name)
+			&& ms_check_exist(shard->handle, job->path) != MS_ERR_NONE) {
+		/*IN_CREATE of this file may be dropped from the list*/
+		MS_DBG("This file is not in DB.");
+		_ms_inoti_coalesce_insert(shard, job->path);
+	}
+	else {
+		if (!ms_inoti_find_ignore_file(job->path)) {
+			/*in case of replace */
+			MS_DBG("This case is replacement or changing meta data.");
+			_ms_inoti_coalesce_refresh(shard, job->path);
+		} else {
+			/*This is ignore case*/
+		}
+	}
+}
+
+/*files of a directory go to the shard of its watch, they are ordered with later events of the directory*/
+static ms_walk_result_t _ms_inoti_insert_new_file(ms_walk_batch *batch, void *user_data)
+{
+	int i;
+	int wd = -1;
+	const char *path;
+	char dir_path[MS_FILE_PATH_LEN_MAX];
+	ms_inoti_job_info *job;
+	ms_inoti_shard_info *shard = user_data;
+	ms_inoti_shard_info *target = shard;
+
+	if (batch->dir_len < (int)sizeof(dir_path)) {
+		memcpy(dir_path, batch->path, batch->dir_len);
+		dir_path[batch->dir_len] = '\0';
+
+		/*polled directory has no watch and no events*/
+		wd = _ms_inoti_get_watch_wd(dir_path);
+		if (wd >= 0)
+			target = _ms_inoti_get_shard(shard->storage, wd);
+	}
+
+	for (i = 0; i < batch->count; i++) {
+		path = ms_walk_entry_path(batch, i);
+		if (path == NULL)
+			continue;
+
+		if (target == shard) {
+			_ms_inoti_coalesce_insert(shard, path);
+			continue;
+		}
+
+		job = _ms_inoti_new_job(MS_INOTI_JOB_INSERT, wd, NULL, path, NULL);
+		if (job != NULL)
+			g_async_queue_push(target->queue, job);
+	}
+
+	return MS_WALK_CONTINUE;
+}
+
+/*new or moved-in directory gets watches, its files are inserted by the shards of their directories*/
+static void _ms_inoti_scan_dir(ms_inoti_shard_info *shard, ms_inoti_job_info *job)
+{
+	int err;
+
+	err = ms_walk_dir(job->path, _ms_inoti_watch_new_dir, _ms_inoti_insert_new_file, shard);
+	if (err != MS_ERR_NONE)
+		MS_DBG_ERR("[%s] ms_walk_dir error : %d", job->path, err);
+}
+
+/*return false if shard has to stop*/
+static bool _ms_inoti_run_job(ms_inoti_shard_info *shard, ms_inoti_job_info *job)
+{
+	ms_coalesce_info *node;
+
+	switch (job->type) {
+	case MS_INOTI_JOB_CREATE:
+		_ms_inoti_add_create_file_list(shard, job->wd, job->name);
+		break;
+	case MS_INOTI_JOB_CLOSE_WRITE:
+		_ms_inoti_close_write(shard, job);
+		break;
+	case MS_INOTI_JOB_INSERT:
+		_ms_inoti_coalesce_insert(shard, job->path);
+		break;
+	case MS_INOTI_JOB_DELETE:
+		_ms_inoti_coalesce_delete(shard, job->path);
+		break;
+	case MS_INOTI_JOB_MOVE:
+		_ms_inoti_coalesce_move(shard, job->path_from, job->path);
+		break;
+	case MS_INOTI_JOB_SCAN_DIR:
+		_ms_inoti_scan_dir(shard, job);
+		break;
+	case MS_INOTI_JOB_FENCE:
+		_ms_inoti_flush_all(shard);
+		_ms_inoti_done_sync(shard);
+		break;
+	case MS_INOTI_JOB_CLEAR:
+		/*files of detached storage are gone, waiting actions are dropped*/
+		while ((node = g_queue_peek_head(shard->coalesce_queue)) != NULL)
+			_ms_inoti_remove_coalesce(shard, node);
+		while ((node = g_queue_peek_head(shard->tombstone_queue)) != NULL)
+			_ms_inoti_remove_coalesce(shard, node);
+		_ms_inoti_end_batch(shard);
+		_ms_inoti_clear_create_file_list(shard);
+		_ms_inoti_done_sync(shard);
+		break;
+	case MS_INOTI_JOB_STOP:
+		_ms_inoti_flush_all(shard);
+		return false;
+	}
+
+	return true;
+}
+
+static gpointer _ms_inoti_shard_thread(gpointer data)
+{
+	int err;
+	int timeout;
+	GTimeVal end_time;
+	ms_inoti_job_info *job;
+	ms_inoti_shard_info *shard = data;
+	bool run = true;
+
+	err = ms_connect_db(&shard->handle);
+	if (err != MS_ERR_NONE) {
+		MS_DBG_ERR("[%s:%d] ms_connect_db failed : %d", shard->storage->root, shard->index, err);
+		shard->handle = NULL;
+	}
+
+	while (run) {
+		/*wait more events of same file only until the oldest action runs*/
+		timeout = _ms_inoti_get_coalesce_timeout(shard);
+		if (timeout < 0) {
+			job = g_async_queue_pop(shard->queue);
+		} else {
+			g_get_current_time(&end_time);
+			g_time_val_add(&end_time, (glong)timeout * 1000);
+			job = g_async_queue_timed_pop(shard->queue, &end_time);
+		}
+
+		if (job != NULL) {
+			run = _ms_inoti_run_job(shard, job);
+			_ms_inoti_free_job(job);
+		}
+
+		_ms_inoti_flush_coalesce(shard, false);
+		_ms_inoti_check_batch(shard);
+
+		if (g_async_queue_length(shard->queue) <= 0)
+			_ms_inoti_print_shard_stats(shard);
+	}
+
+	if (shard->handle) ms_disconnect_db(&shard->handle);
+
+	return NULL;
+}
+
+static int _ms_inoti_shard_init(ms_inoti_storage_info *storage)
+{
+	int i;
+	int err;
+	int count = 0;
+	ms_inoti_shard_info *shard;
+
+	if (!ms_config_get_int(MS_INOTI_SHARD_KEY, &count) || count <= 0) {
+		/*one shard per core*/
+		count = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (count < 1)
+		count = 1;
+	if (count > MS_INOTI_SHARD_MAX)
+		count = MS_INOTI_SHARD_MAX;
+
+	MS_DBG("[%s] shard : %d", storage->root, count);
+
+	storage->fence_mutex = g_mutex_new();
+	storage->fence_cond = g_cond_new();
+	storage->shards = calloc(count, sizeof(ms_inoti_shard_info));
+	if (storage->fence_mutex == NULL || storage->fence_cond == NULL || storage->shards == NULL) {
+		MS_DBG_ERR("shard init fail");
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+	storage->shard_count = count;
+
+	for (i = 0; i < count; i++) {
+		shard = &storage->shards[i];
+		shard->storage = storage;
+		shard->index = i;
+
+		shard->queue = g_async_queue_new();
+		shard->pending = g_queue_new();
+		if (shard->queue == NULL || shard->pending == NULL) {
+			MS_DBG_ERR("shard init fail");
+			return MS_ERR_ALLOCATE_MEMORY_FAIL;
+		}
+
+		err = _ms_inoti_create_file_init(shard);
+		if (err != MS_ERR_NONE)
+			return err;
+
+		err = _ms_inoti_batch_init(shard);
+		if (err != MS_ERR_NONE)
+			return err;
+
+		err = _ms_inoti_coalesce_init(shard);
+		if (err != MS_ERR_NONE)
+			return err;
+	}
+
+	return MS_ERR_NONE;
+}
+
+static void _ms_inoti_start_shards(ms_inoti_storage_info *storage)
+{
+	int i;
+
+	for (i = 0; i < storage->shard_count; i++) {
+		storage->shards[i].thread = g_thread_create(_ms_inoti_shard_thread, &storage->shards[i], TRUE, NULL);
+		if (storage->shards[i].thread == NULL)
+			MS_DBG_ERR("[%s:%d] g_thread_create failed", storage->root, i);
+	}
+}
+
+/*waiting actions of all shards are done before they exit*/
+static void _ms_inoti_stop_shards(ms_inoti_storage_info *storage)
+{
+	int i;
+
+	for (i = 0; i < storage->shard_count; i++)
+		_ms_inoti_add_job(&storage->shards[i], MS_INOTI_JOB_STOP, -1, NULL, NULL, NULL);
+	_ms_inoti_dispatch_jobs(storage);
+
+	for (i = 0; i < storage->shard_count; i++) {
+		if (storage->shards[i].thread != NULL) {
+			g_thread_join(storage->shards[i].thread);
+			storage->shards[i].thread = NULL;
+		}
+	}
+}
+
+/*file is renamed between directories, shards of both directories see it in order*/
+static void _ms_inoti_dispatch_move(ms_inoti_storage_info *storage, int wd_from, int wd_to,
+					const char *path_from, const char *path_to)
+{
+	ms_inoti_shard_info *shard_from = _ms_inoti_get_shard(storage, wd_from);
+	ms_inoti_shard_info *shard_to = _ms_inoti_get_shard(storage, wd_to);
+
+	if (shard_from == shard_to) {
+		_ms_inoti_add_job(shard_to, MS_INOTI_JOB_MOVE, wd_to, NULL, path_to, path_from);
+		return;
+	}
+
+	/*record of path_from is written by its shard first, new events of path_from wait for the move*/
+	_ms_inoti_fence_shard(storage, shard_from);
+	_ms_inoti_add_job(shard_to, MS_INOTI_JOB_MOVE, wd_to, NULL, path_to, path_from);
+	_ms_inoti_fence_shard(storage, shard_to);
+}
+
+static void _ms_inoti_free_poll_dir(gpointer data)
+{
+	ms_poll_dir_info *node = data;
+
+	MS_SAFE_FREE(node->path);
+	MS_SAFE_FREE(node);
+}
+
+static int _ms_inoti_poll_dir_init(void)
+{
+	FILE *fp;
+	int max_watch = 0;
+
+	fp = fopen(MS_WATCH_MAX_PATH, "r");
+	if (fp != NULL) {
+		if (fscanf(fp, "%d", &max_watch) != 1)
+			max_watch = 0;
+		fclose(fp);
+	}
+
+	if (max_watch > 0)
+		watch_budget = max_watch / 100 * MS_WATCH_BUDGET_RATIO;
+	else
+		watch_budget = MS_WATCH_BUDGET_DEFAULT;
+
+	MS_DBG("watch budget : %d (max_user_watches : %d)", watch_budget, max_watch);
+
+	if (poll_dir_table == NULL)
+		poll_dir_table = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, _ms_inoti_free_poll_dir);
+
+	if (poll_dir_mutex == NULL)
+		poll_dir_mutex = g_mutex_new();
+
+	if (poll_dir_table == NULL || poll_dir_mutex == NULL) {
+		MS_DBG_ERR("poll dir table init fail");
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+
+	return MS_ERR_NONE;
+}
+
+/*default folders and storage roots*/
+static bool _ms_inoti_is_user_dir(const char *path)
+{
+	int i;
+	int len;
+	const char *sub;
+	const char *roots[] = {MS_ROOT_PATH_INTERNAL, MS_ROOT_PATH_EXTERNAL};
+	const char *user_dirs[] = {"Images", "Videos", "Sounds", "Downloads", "Camera"};
+
+	for (i = 0; i < 2; i++) {
+		len = strlen(roots[i]);
+		if (strncmp(path, roots[i], len) == 0 && (path[len] == '\0' || path[len] == '/'))
+			break;
+	}
+	if (i == 2)
+		return false;
+
+	sub = path + len;
+	if (sub[0] == '\0')
+		return true;
+	sub++;
+
+	for (i = 0; i < (int)(sizeof(user_dirs) / sizeof(user_dirs[0])); i++) {
+		len = strlen(user_dirs[i]);
+		if (strncmp(sub, user_dirs[i], len) == 0 && (sub[len] == '\0' || sub[len] == '/'))
+			return true;
+	}
+
+	return false;
+}
+
+/*storage of path, paths out of storages belong to internal storage*/
+static ms_inoti_storage_info *_ms_inoti_get_storage(const char *path)
+{
+	if (ms_get_storage_type_by_full(path) == MS_STORATE_EXTERNAL)
+		return &inoti_storage[MS_STORATE_EXTERNAL];
+
+	return &inoti_storage[MS_STORAGE_INTERNAL];
+}
+
+/*control message to event loop : check power off and instance of storage*/
+static void _ms_inoti_wake_storage(ms_inoti_storage_info *storage)
+{
+	if (eventfd_write(storage->event_fd, 1) < 0)
+		MS_DBG_ERR("eventfd_write failed : %s", strerror(errno));
+}
+
+static bool _ms_inoti_has_watch_budget(const char *path)
+{
+	int budget = _ms_inoti_get_watch_budget();
+	int limit = budget;
+
+	if (!_ms_inoti_is_user_dir(path))
+		limit -= budget / 100 * MS_WATCH_RESERVE_RATIO;
+
+	return (_ms_inoti_get_watch_count() < limit);
+}
+
+static void _ms_inoti_add_poll_dir(const char *path)
+{
+	struct stat st;
+	bool first;
+	ms_poll_dir_info *node;
+	ms_inoti_storage_info *storage;
+
+	node = malloc(sizeof(ms_poll_dir_info));
+	if (node == NULL) {
+		MS_DBG_ERR("malloc fail");
+		return;
+	}
+
+	node->path = strdup(path);
+	if (node->path == NULL) {
+		MS_DBG_ERR("strdup fail");
+		MS_SAFE_FREE(node);
+		return;
+	}
+	node->mtime = (stat(path, &st) == 0) ? st.st_mtime : 0;
+
+	storage = _ms_inoti_get_storage(path);
+
+	g_mutex_lock(poll_dir_mutex);
+	first = (storage->poll_dir_time == 0);
+	if (first)
+		storage->poll_dir_time = g_get_monotonic_time() + (gint64)MS_POLL_DIR_TIME * G_USEC_PER_SEC;
+	g_hash_table_replace(poll_dir_table, node->path, node);
+	g_mutex_unlock(poll_dir_mutex);
+
+	/*timer of event loop is armed only for the poll dirs it knows*/
+	if (first && storage->event_fd >= 0)
+		_ms_inoti_wake_storage(storage);
+
+	MS_DBG("add poll dir : %s", path);
+}
+
+static bool _ms_inoti_find_poll_dir(const char *path)
+{
+	bool res;
+
+	g_mutex_lock(poll_dir_mutex);
+	res = (g_hash_table_lookup(poll_dir_table, path) != NULL);
+	g_mutex_unlock(poll_dir_mutex);
+
+	return res;
+}
+
+static bool _ms_inoti_is_sub_path(const char *path, const char *parent)
+{
+	int len = strlen(parent);
+
+	return (strncmp(path, parent, len) == 0 && (path[len] == '\0' || path[len] == '/'));
+}
+
+static gboolean _ms_inoti_check_poll_dir(gpointer key, gpointer value, gpointer user_data)
+{
+	return _ms_inoti_is_sub_path(key, user_data);
+}
+
+static void _ms_inoti_delete_poll_dir(const char *path, bool recursive)
+{
+	g_mutex_lock(poll_dir_mutex);
+	if (recursive)
+		g_hash_table_foreach_remove(poll_dir_table, _ms_inoti_check_poll_dir, (gpointer)path);
+	else
+		g_hash_table_remove(poll_dir_table, path);
+	g_mutex_unlock(poll_dir_mutex);
+}
+
+static void _ms_inoti_rename_poll_dir(const char *path_from, const char *path_to)
+{
+	GList *nodes;
+	GList *iter;
+	ms_poll_dir_info *node;
+	char path[MS_FILE_PATH_LEN_MAX] = { 0 };
+	int len = strlen(path_from);
+
+	g_mutex_lock(poll_dir_mutex);
+
+	nodes = g_hash_table_get_values(poll_dir_table);
+	for (iter = nodes; iter != NULL; iter = iter->next) {
+		node = iter->data;
+		if (!_ms_inoti_is_sub_path(node->path, path_from))
+			continue;
+
+		if (ms_strappend(path, sizeof(path), "%s%s", path_to, node->path + len) != MS_ERR_NONE)
+			continue;
+
+		g_hash_table_steal(poll_dir_table, node->path);
+		MS_SAFE_FREE(node->path);
+		node->path = strdup(path);
+		if (node->path == NULL) {
+			MS_SAFE_FREE(node);
+			continue;
+		}
+		g_hash_table_replace(poll_dir_table, node->path, node);
+	}
+	g_list_free(nodes);
+
+	g_mutex_unlock(poll_dir_mutex);
+}
+
+int ms_inoti_get_poll_dir_count(void)
+{
+	int count;
+
+	g_mutex_lock(poll_dir_mutex);
+	count = g_hash_table_size(poll_dir_table);
+	g_mutex_unlock(poll_dir_mutex);
+
+	return count;
+}
+
+/*msec until next polling, -1 if there is no polled directory*/
+static int _ms_inoti_get_poll_dir_timeout(ms_inoti_storage_info *storage)
+{
+	gint64 remain;
+
+	g_mutex_lock(poll_dir_mutex);
+	remain = storage->poll_dir_time;
+	g_mutex_unlock(poll_dir_mutex);
+
+	if (remain == 0)
+		return -1;
+
+	remain -= g_get_monotonic_time();
+	if (remain < 0)
+		return 0;
+
+	return (int)(remain / 1000) + 1;
+}
+
+static int _ms_inoti_active_dir_init(ms_inoti_storage_info *storage)
+{
+	storage->active_dir_table = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, free);
+	if (storage->active_dir_table == NULL) {
+		MS_DBG_ERR("g_hash_table_new_full failed");
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+
+	return MS_ERR_NONE;
+}
+
+/*return true if events of this directory are dropped*/
+static bool _ms_inoti_mark_active_dir(ms_inoti_storage_info *storage, int wd, time_t now)
+{
+	ms_active_dir_info *node;
+
+	node = g_hash_table_lookup(storage->active_dir_table, GINT_TO_POINTER(wd));
+	if (node == NULL) {
+		node = malloc(sizeof(ms_active_dir_info));
+		if (node == NULL) {
+			MS_DBG_ERR("malloc failed");
+			return false;
+		}
+		node->wd = wd;
+		node->first = now;
+		node->last = now;
+		node->count = 0;
+		node->hot = false;
+		g_hash_table_insert(storage->active_dir_table, GINT_TO_POINTER(wd), node);
+	}
+
+	if (node->last != now) {
+		node->last = now;
+		node->count = 0;
+	}
+	node->count++;
+
+	if (!node->hot && node->count > MS_HOT_DIR_EVENT_COUNT) {
+		/*rescanning once is cheaper than handling each event*/
+		MS_DBG("directory is flooded : %d", wd);
+		node->hot = true;
+		storage->hot_dir_count++;
+	}
+
+	return node->hot;
+}
+
+/*rescan of flooded directory inserts and refreshes files, but it may not remove items of gone files*/
+static bool _ms_inoti_rescan_covers(ms_inoti_storage_info *storage, struct inotify_event *event)
+{
+	if (event->mask & (IN_ISDIR | IN_DELETE | IN_MOVED_FROM))
+		return false;
+
+	/*the other side of a rename is waiting, pairing keeps the item*/
+	if ((event->mask & IN_MOVED_TO)
+		&& g_hash_table_lookup(storage->move_file_table, GUINT_TO_POINTER(event->cookie)) != NULL)
+		return false;
+
+	return true;
+}
+
+static void _ms_inoti_rescan_active_dir(ms_active_dir_info *node)
+{
+	char path[MS_FILE_PATH_LEN_MAX] = { 0 };
+
+	if (_ms_inoti_get_watch_path(node->wd, path, sizeof(path)))
+		ms_scan_request(path, MS_SCAN_DIRECTORY, node->first - 1);
+}
+
+static gboolean _ms_inoti_check_active_dir(gpointer key, gpointer value, gpointer user_data)
+{
+	ms_active_dir_info *node = value;
+	ms_inoti_storage_info *storage = user_data;
+	time_t now = time(NULL);
+
+	if (node->hot) {
+		if (now - node->last < MS_HOT_DIR_QUIET_TIME)
+			return false;
+
+		/*flood is over, catch up the dropped events*/
+		_ms_inoti_rescan_active_dir(node);
+		storage->hot_dir_count--;
+		return true;
+	}
+
+	/*burst of this directory is over*/
+	return (now - node->last > MS_ACTIVE_DIR_TIME);
+}
+
+static void _ms_inoti_expire_active_dir(ms_inoti_storage_info *storage)
+{
+	g_hash_table_foreach_remove(storage->active_dir_table, _ms_inoti_check_active_dir, storage);
+}
+
+/*msec until quiet time of flooded directories is checked, -1 if there is no flooded directory*/
+static int _ms_inoti_get_active_dir_timeout(ms_inoti_storage_info *storage)
+{
+	return (storage->hot_dir_count > 0) ? 1000 : -1;
+}
+
+static void _ms_inoti_request_rescan(ms_inoti_storage_info *storage)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	/*events are lost from the directories which were active in the burst*/
+	g_hash_table_iter_init(&iter, storage->active_dir_table);
+	while (g_hash_table_iter_next(&iter, NULL, &value))
+		_ms_inoti_rescan_active_dir(value);
+
+	/*there is no clue, validate whole storage*/
+	if (g_hash_table_size(storage->active_dir_table) == 0)
+		ms_scan_request(storage->root, MS_SCAN_PART, 0);
+
+	g_hash_table_remove_all(storage->active_dir_table);
+	storage->hot_dir_count = 0;
+}
+
+/*arm timer of event loop for the nearest deadline, -1 disarms it*/
+static void _ms_inoti_set_timer(ms_inoti_storage_info *storage, int timeout)
+{
+	struct itimerspec spec;
+
+	memset(&spec, 0, sizeof(spec));
+
+	if (timeout >= 0) {
+		spec.it_value.tv_sec = timeout / 1000;
+		spec.it_value.tv_nsec = (timeout % 1000) * 1000000;
+		/*zero disarms timer*/
+		if (timeout == 0)
+			spec.it_value.tv_nsec = 1;
+	}
+
+	if (timerfd_settime(storage->timer_fd, 0, &spec, NULL) < 0)
+		MS_DBG_ERR("timerfd_settime failed : %s", strerror(errno));
+}
+
+static int _ms_inoti_epoll_add(ms_inoti_storage_info *storage, int fd)
+{
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+
+	if (epoll_ctl(storage->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		MS_DBG_ERR("epoll_ctl failed : %s", strerror(errno));
+		return MS_ERR_UNKNOWN_ERROR;
+	}
+
+	return MS_ERR_NONE;
+}
+
+static void _ms_inoti_clear_move_file(ms_inoti_storage_info *storage)
+{
+	ms_move_file_info *move_node;
+
+	while ((move_node = g_queue_pop_head(storage->move_file_queue)) != NULL) {
+		g_hash_table_remove(storage->move_file_table, GUINT_TO_POINTER(move_node->cookie));
+		_ms_inoti_free_move_file(move_node);
+	}
+}
+
+/*files of detached storage are gone, waiting actions are dropped*/
+static void _ms_inoti_clear_storage(ms_inoti_storage_info *storage)
+{
+	int i;
+	ms_inoti_job_info *job;
+
+	_ms_inoti_clear_move_file(storage);
+
+	for (i = 0; i < storage->shard_count; i++) {
+		while ((job = g_queue_pop_head(storage->shards[i].pending)) != NULL)
+			_ms_inoti_free_job(job);
+	}
+
+	_ms_inoti_sync_shards(storage, NULL, MS_INOTI_JOB_CLEAR);
+
+	g_hash_table_remove_all(storage->active_dir_table);
+	storage->hot_dir_count = 0;
+}
+
+static int _ms_inoti_storage_init(ms_storage_type_t storage_type)
+{
+	int err;
+	ms_inoti_storage_info *storage = &inoti_storage[storage_type];
+
+	storage->storage_type = storage_type;
+	storage->root = (storage_type == MS_STORAGE_INTERNAL) ? MS_ROOT_PATH_INTERNAL : MS_ROOT_PATH_EXTERNAL;
+	storage->fd = -1;
+	storage->close_fd = -1;
+
+	if (storage->mutex == NULL)
+		storage->mutex = g_mutex_new();
+
+	if (storage->mutex == NULL) {
+		MS_DBG_ERR("g_mutex_new failed");
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+
+	storage->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	storage->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	storage->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (storage->epoll_fd < 0 || storage->event_fd < 0 || storage->timer_fd < 0) {
+		MS_DBG_ERR("event loop init fail : %s", strerror(errno));
+		return MS_ERR_UNKNOWN_ERROR;
+	}
+
+	err = _ms_inoti_epoll_add(storage, storage->event_fd);
+	if (err != MS_ERR_NONE)
+		return err;
+
+	err = _ms_inoti_epoll_add(storage, storage->timer_fd);
+	if (err != MS_ERR_NONE)
+		return err;
+
+	err = _ms_inoti_shard_init(storage);
+	if (err != MS_ERR_NONE)
+		return err;
+
+	err = _ms_inoti_move_file_init(storage);
+	if (err != MS_ERR_NONE)
+		return err;
+
+	err = _ms_inoti_active_dir_init(storage);
+	if (err != MS_ERR_NONE)
+		return err;
+
+	return MS_ERR_NONE;
+}
+
+int ms_inoti_init(void)
+{
+	int err;
+	int i;
+	int value = 0;
+
+	err = _ms_inoti_watch_table_init();
+	if (err != MS_ERR_NONE)
+		return err;
+
+	err = _ms_inoti_ignore_file_init();
+	if (err != MS_ERR_NONE)
+		return err;
+
+	err = _ms_inoti_poll_dir_init();
+	if (err != MS_ERR_NONE)
+		return err;
+
+	for (i = 0; i < MS_INOTI_STORAGE_NUM; i++) {
+		err = _ms_inoti_storage_init(i);
+		if (err != MS_ERR_NONE)
+			return err;
+	}
+
+	/*fanotify watches whole file system without adding watch of each directory*/
+	if (ms_config_get_int(MS_FANOTIFY_KEY, &value) && value != 0) {
+		fanoti_enabled = true;
+		if (ms_inoti_attach_storage(MS_STORAGE_INTERNAL) == MS_ERR_NONE) {
+			MS_DBG("fanotify is used");
+			return MS_ERR_NONE;
+		}
+		fanoti_enabled = false;
+	}
+
+	return ms_inoti_attach_storage(MS_STORAGE_INTERNAL);
+}
+
+/*called with storage locked*/
+static int _ms_inoti_open_instance(ms_inoti_storage_info *storage)
+{
+	int fd;
+
+	if (fanoti_enabled) {
+		fd = ms_fanoti_init(storage->storage_type);
+		if (fd < 0)
+			return -1;
+
+		/*file system of root is marked at once*/
+		if (ms_fanoti_mark(storage->storage_type, fd, storage->root) != MS_ERR_NONE) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	fd = inotify_init();
+	if (fd < 0) {
+		MS_DBG_ERR("inotify_init failed : %s", strerror(errno));
+		return -1;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	return fd;
+}
+
+int ms_inoti_attach_storage(ms_storage_type_t storage_type)
+{
+	int fd;
+	ms_inoti_storage_info *storage = &inoti_storage[storage_type];
+
+	g_mutex_lock(storage->mutex);
+
+	if (storage->fd >= 0) {
+		g_mutex_unlock(storage->mutex);
+		return MS_ERR_NONE;
+	}
+
+	fd = _ms_inoti_open_instance(storage);
+	if (fd < 0) {
+		g_mutex_unlock(storage->mutex);
+		return MS_ERR_UNKNOWN_ERROR;
+	}
+
+	storage->fd = fd;
+
+	g_mutex_unlock(storage->mutex);
+
+	MS_DBG("attach storage : %s", storage->root);
+
+	/*event loop polls new instance*/
+	_ms_inoti_wake_storage(storage);
+
+	return MS_ERR_NONE;
+}
+
+void ms_inoti_detach_storage(ms_storage_type_t storage_type)
+{
+	ms_inoti_storage_info *storage = &inoti_storage[storage_type];
+
+	_ms_inoti_delete_watch_recursive(storage->root);
+	_ms_inoti_delete_poll_dir(storage->root, true);
+
+	/*closing instance removes all watches of storage in kernel*/
+	g_mutex_lock(storage->mutex);
+	if (storage->fd >= 0) {
+		if (storage->close_fd >= 0) {
+			/*event loop is not woken up yet, it does not poll this instance*/
+			close(storage->fd);
+		} else {
+			storage->close_fd = storage->fd;
+		}
+		storage->fd = -1;
+	}
+	g_mutex_unlock(storage->mutex);
+
+	/*file system of reinserted card can have the same id, it is marked again*/
+	if (fanoti_enabled)
+		ms_fanoti_clear(storage_type);
+
+	_ms_inoti_wake_storage(storage);
+
+	MS_DBG("detach storage : %s", storage->root);
+
+	/*active flush */
+	malloc_trim(0);
+}
+
+void ms_inoti_stop(void)
+{
+	int i;
+
+	for (i = 0; i < MS_INOTI_STORAGE_NUM; i++)
+		_ms_inoti_wake_storage(&inoti_storage[i]);
+}
+
+static int _ms_inoti_add_watch_path(const char *path)
+{
+	int wd;
+	int err;
+	ms_inoti_storage_info *storage;
+
+	if (fanoti_enabled) {
+		storage = _ms_inoti_get_storage(path);
+
+		g_mutex_lock(storage->mutex);
+		if (storage->fd >= 0)
+			err = ms_fanoti_mark(storage->storage_type, storage->fd, path);
+		else
+			err = MS_ERR_INVALID_DIR_PATH;
+		g_mutex_unlock(storage->mutex);
+
+		return err;
+	}
+
+	/*find same folder */
+	if (_ms_inoti_watch_exist(path)) {
+		MS_DBG("watch is already added: %s", path);
+		return MS_ERR_NONE;
+	}
+
+	if (_ms_inoti_find_poll_dir(path))
+		return MS_ERR_NONE;
+
+	/*over the budget, directory is polled*/
+	if (!_ms_inoti_has_watch_budget(path)) {
+		_ms_inoti_add_poll_dir(path);
+		return MS_ERR_NONE;
+	}
+
+	storage = _ms_inoti_get_storage(path);
 
-		/*in case of directory */
-		if (ent.d_type == DT_DIR) {
-			_ms_inoti_scan_renamed_folder(handle, path_from, path_to);
-		}
+	/*instance is not closed while the watch is added*/
+	g_mutex_lock(storage->mutex);
 
-		/*in case of file */
-		if (ent.d_type == DT_REG) {
-			src_storage = ms_get_storage_type_by_full(path_from);
-			des_storage = ms_get_storage_type_by_full(path_to);
+	if (storage->fd < 0) {
+		g_mutex_unlock(storage->mutex);
+		MS_DBG_ERR("storage is detached : %s", path);
+		return MS_ERR_INVALID_DIR_PATH;
+	}
 
-			if ((src_storage != MS_ERR_INVALID_FILE_PATH)
-			    && (des_storage != MS_ERR_INVALID_FILE_PATH))
-				ms_move_item(handle, src_storage, des_storage, path_from, path_to);
-			else {
-				MS_DBG_ERR("src_storage : %s", src_storage);
-				MS_DBG_ERR("des_storage : %s", des_storage);
-			}
+	/*there is no same path. */
+	wd = inotify_add_watch(storage->fd, path,
+			      IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+			      IN_MOVED_FROM | IN_MOVED_TO);
+	if (wd < 0) {
+		err = errno;
+		g_mutex_unlock(storage->mutex);
+		MS_DBG_ERR("inotify_add_watch failed : %s [%s]", path, strerror(err));
+		if (err == ENOSPC) {
+			/*other processes use watches too*/
+			_ms_inoti_set_watch_budget(_ms_inoti_get_watch_count());
+			_ms_inoti_add_poll_dir(path);
+			return MS_ERR_NONE;
 		}
+		return MS_ERR_UNKNOWN_ERROR;
 	}
 
-	closedir(dp);
+	err = _ms_inoti_insert_watch(MS_INOTI_WD_KEY(storage->storage_type, wd), path);
+
+	g_mutex_unlock(storage->mutex);
 
-	return 0;
+	MS_DBG("add watch : %s", path);
+
+	return err;
 }
 
-int ms_inoti_add_ignore_file(const char *path)
+bool ms_inoti_is_watched(const char *path)
 {
-	ms_ignore_file_info *new_node;
+	if (fanoti_enabled)
+		return true;
 
-	new_node = ms_inoti_find_ignore_file(path);
-	if (new_node != NULL)
-		return MS_ERR_NONE;
+	return (_ms_inoti_watch_exist(path) || _ms_inoti_find_poll_dir(path));
+}
 
-	new_node = malloc(sizeof(ms_ignore_file_info));
-	new_node->path = strdup(path);
+void ms_inoti_add_watch(char *path)
+{
+	_ms_inoti_add_watch_path(path);
+}
 
-	/*first created file */
-	if (latest_ignore_file == NULL) {
-		latest_ignore_file = malloc(sizeof(ms_ignore_file_info));
-		new_node->previous = NULL;
-	} else {
-		latest_ignore_file->next = new_node;
-		new_node->previous = latest_ignore_file;
-	}
-	new_node->next = NULL;
+void ms_inoti_remove_watch_recursive(char *path)
+{
+	_ms_inoti_delete_watch_recursive(path);
+	_ms_inoti_delete_poll_dir(path, true);
+
+	/*active flush */
+	 malloc_trim(0);
+}
 
-	latest_ignore_file = new_node;
+void ms_inoti_remove_watch(char *path)
+{
+	_ms_inoti_delete_watch(path);
+	_ms_inoti_delete_poll_dir(path, false);
 
-	return MS_ERR_NONE;
+	/*active flush */
+	malloc_trim(0);
 }
 
-int ms_inoti_delete_ignore_file(ms_ignore_file_info * delete_node)
+void ms_inoti_modify_watch(char *path_from, char *path_to)
 {
-	if (delete_node->previous != NULL)
-		delete_node->previous->next = delete_node->next;
-	if (delete_node->next != NULL)
-		delete_node->next->previous = delete_node->previous;
+	int err;
 
-	if (delete_node == latest_ignore_file) {
-		latest_ignore_file = delete_node->previous;
+	/*change path of directory*/
+	err = _ms_inoti_rename_watch(path_from, path_to);
+	_ms_inoti_rename_poll_dir(path_from, path_to);
+
+	/*this is new directory*/
+	if (err != MS_ERR_NONE) {
+		ms_inoti_add_watch(path_to);
 	}
+}
+
+void ms_inoti_begin_scan(ms_storage_type_t storage_type)
+{
+	ms_inoti_storage_info *storage = &inoti_storage[storage_type];
+
+	if (storage->mutex == NULL)
+		return;
 
-	MS_SAFE_FREE(delete_node->path);
-	MS_SAFE_FREE(delete_node);
+	/*0 means no scan*/
+	if (++scan_epoch_count == 0)
+		scan_epoch_count++;
 
+	/*every directory known now waits for the scan, it is cleared when the scan reads it*/
+	_ms_inoti_set_watch_epoch(storage->root, scan_epoch_count, true);
 
-	return MS_ERR_NONE;
+	g_mutex_lock(storage->mutex);
+	storage->scan_epoch = scan_epoch_count;
+	g_mutex_unlock(storage->mutex);
+
+	MS_DBG("scan epoch %u of storage %d", scan_epoch_count, storage_type);
 }
 
-ms_ignore_file_info *ms_inoti_find_ignore_file(const char *path)
+void ms_inoti_end_scan(ms_storage_type_t storage_type)
 {
-	ms_ignore_file_info *node = NULL;
-	
-	node = latest_ignore_file;
-	while (node != NULL) {
-		if (strcmp(node->path, path) == 0) {
-			return node;
-		}
+	ms_inoti_storage_info *storage = &inoti_storage[storage_type];
 
-		node = node->previous;
-	}
+	if (storage->mutex == NULL)
+		return;
 
-	return NULL;
+	/*stamps left by stopped scan are stale, they never match a new epoch*/
+	g_mutex_lock(storage->mutex);
+	storage->scan_epoch = 0;
+	g_mutex_unlock(storage->mutex);
 }
 
-void ms_inoti_delete_mmc_ignore_file(void)
+void ms_inoti_set_scan_done(const char *path)
 {
-	ms_ignore_file_info *prv_node = NULL;
-	ms_ignore_file_info *cur_node = NULL;
-	ms_ignore_file_info *del_node = NULL;
+	_ms_inoti_set_watch_epoch(path, 0, false);
+}
 
-	if (latest_ignore_file != NULL) {
-		cur_node = latest_ignore_file;
-		while (cur_node != NULL) {
-			if (strstr(cur_node->path, MS_ROOT_PATH_EXTERNAL) != NULL) {
-				if (prv_node != NULL) {
-					prv_node->previous = cur_node->previous;
-				}
+/*the running scan has not read the directory yet, it will find files of the directory by itself*/
+static bool _ms_inoti_scan_pending(ms_inoti_storage_info *storage, int wd)
+{
+	guint epoch;
 
-				if (cur_node == latest_ignore_file)
-					latest_ignore_file = latest_ignore_file->previous;
+	if (wd < 0)
+		return false;
 
-				del_node = cur_node;
-			} else {
-				prv_node = cur_node;
-			}
+	g_mutex_lock(storage->mutex);
+	epoch = storage->scan_epoch;
+	g_mutex_unlock(storage->mutex);
 
-			cur_node = cur_node->previous;
+	return (epoch != 0 && _ms_inoti_get_watch_epoch(wd) == epoch);
+}
 
-			if (del_node != NULL) {
-				MS_SAFE_FREE(del_node->path);
-				MS_SAFE_FREE(del_node);
-			}
-		}
-	}
+static void _ms_inoti_collect_dir(const char *path, int wd, void *user_data)
+{
+	GList **dirs = user_data;
+	char *dir;
 
-	/*active flush */
-	malloc_trim(0);
+	dir = strdup(path);
+	if (dir != NULL)
+		*dirs = g_list_prepend(*dirs, dir);
 }
 
-int ms_inoti_init(void)
+static void _ms_inoti_collect_poll_dir(const char *path, GList **dirs)
 {
-	inoti_fd = inotify_init();
-	if (inoti_fd < 0) {
-		perror("inotify_init");
-		MS_DBG_ERR("inotify_init failed");
-		return inoti_fd;
+	GHashTableIter iter;
+	gpointer key;
+
+	g_mutex_lock(poll_dir_mutex);
+	g_hash_table_iter_init(&iter, poll_dir_table);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		if (_ms_inoti_is_sub_path(key, path))
+			_ms_inoti_collect_dir(key, -1, dirs);
 	}
-
-	return MS_ERR_NONE;
+	g_mutex_unlock(poll_dir_mutex);
 }
 
-void ms_inoti_add_watch(char *path)
+/*directory is removed or moved out, items and watches of whole subtree are removed*/
+static void _ms_inoti_delete_folder(ms_inoti_storage_info *storage, char *path)
 {
-	ms_inoti_dir_data *current_dir = NULL;
-	ms_inoti_dir_data *prv_node = NULL;
-	ms_inoti_dir_data *last_node = NULL;
-
-	/*find same folder */
-	if (first_inoti_node != NULL) {
-		last_node = first_inoti_node;
-		while (last_node != NULL) {
-			if (strcmp(path, last_node->name) == 0) {
-				MS_DBG("watch is already added: %s", path);
-				return;
-			}
-			prv_node = last_node;
-			last_node = last_node->next;
-		}
-	}
+	int err;
+	void **handle = storage->handle;
+	GList *dirs = NULL;
+	GList *iter;
 
-	/*there is no same path. */
-	current_dir = malloc(sizeof(ms_inoti_dir_data));
-	current_dir->wd = inotify_add_watch(inoti_fd, path,
-			      IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
-			      IN_MOVED_FROM | IN_MOVED_TO);
+	if (ms_support_delete_folder()) {
+		err = ms_delete_folder(handle, path);
+		if (err == MS_ERR_NONE)
+			goto REMOVE_WATCH;
 
-	if (current_dir->wd > 0) {
-		current_dir->name = strdup(path);
-		current_dir->next = NULL;
+		MS_DBG_ERR("ms_delete_folder error : %d", err);
+	}
 
-		if (first_inoti_node == NULL) {
-			first_inoti_node = current_dir;
-		} else {
-			/*if next node of current node is NULL, it is the lastest node. */
-			prv_node->next = current_dir;
-		}
-		MS_DBG("add watch : %s", path);
-	} else {
-		MS_DBG_ERR("inotify_add_watch failed");
-		MS_SAFE_FREE(current_dir);
+	if (!ms_support_folder_validity()) {
+		/*items of deleted directory are not in storage any more, validation drops them*/
+		MS_DBG_ERR("items under %s are deleted by scan of %s", path, storage->root);
+		ms_scan_request(storage->root, MS_SCAN_PART, 0);
+		goto REMOVE_WATCH;
 	}
-}
 
-int ms_inoti_add_watch_with_node(ms_dir_scan_info * const node, int depth)
-{
-	int err;
-	char full_path[MS_FILE_PATH_LEN_MAX] = { 0 };
-	ms_inoti_dir_data *current_dir = NULL;
-	ms_inoti_dir_data *prv_node = NULL;
-	ms_inoti_dir_data *last_node = NULL;
+	/*files are already gone, sub directories are known by watches*/
+	_ms_inoti_foreach_watch(path, _ms_inoti_collect_dir, &dirs);
+	_ms_inoti_collect_poll_dir(path, &dirs);
+	if (!_ms_inoti_watch_exist(path) && !_ms_inoti_find_poll_dir(path))
+		_ms_inoti_collect_dir(path, -1, &dirs);
 
-	err = ms_get_full_path_from_node(node, full_path, depth);
-	if (err != MS_ERR_NONE)
-		return MS_ERR_INVALID_DIR_PATH;
+	ms_delete_start(handle);
 
-	/*find same folder */
-	if (first_inoti_node != NULL) {
-		last_node = first_inoti_node;
-		while (last_node != NULL) {
-			if (strcmp(full_path, last_node->name) == 0) {
-				return MS_ERR_NONE;
-			}
-			prv_node = last_node;
-			last_node = last_node->next;
-		}
+	for (iter = dirs; iter != NULL; iter = iter->next) {
+		ms_invalidate_folder_items(handle, iter->data);
+		ms_delete_invalid_folder_items(handle, iter->data);
 	}
 
-	/*there is no same path. */
-	current_dir = malloc(sizeof(ms_inoti_dir_data));
-	current_dir->wd = inotify_add_watch(inoti_fd, full_path,
-			      IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
-			      IN_MOVED_FROM | IN_MOVED_TO);
-	if( current_dir->wd > 0) {
-		current_dir->name = strdup(full_path);
-		current_dir->next = NULL;
+	ms_delete_end(handle);
 
-		if (first_inoti_node == NULL) {
-			first_inoti_node = current_dir;
-		} else {
-			/*if next node of current node is NULL, it is the lastest node. */
-			prv_node->next = current_dir;
-		}
-		MS_DBG("add watch : %s", full_path);
-	} else {
-		MS_DBG_ERR("inotify_add_watch  failed : %d", current_dir->wd);
-		MS_SAFE_FREE(current_dir);
-	}
+	g_list_foreach(dirs, (GFunc)free, NULL);
+	g_list_free(dirs);
 
-	return MS_ERR_NONE;
+REMOVE_WATCH:
+	ms_inoti_remove_watch_recursive(path);
 }
 
-void ms_inoti_remove_watch_recursive(char *path)
+/*IN_MOVED_FROM without IN_MOVED_TO : it is moved out of watched directories*/
+static void _ms_inoti_expire_move_file(ms_inoti_storage_info *storage)
 {
-	ms_inoti_dir_data *prv_node = NULL;
-	ms_inoti_dir_data *cur_node = NULL;
-	ms_inoti_dir_data *del_node = NULL;
-
-	if (first_inoti_node != NULL) {
-		cur_node = first_inoti_node;
-		while (cur_node != NULL) {
-			if (strstr(cur_node->name, path) != NULL) {
-				if (prv_node != NULL) {
-					prv_node->next =
-					    cur_node->next;
-				}
+	gint64 now;
+	ms_move_file_info *node;
 
-				if (cur_node == first_inoti_node)
-					first_inoti_node =
-					    first_inoti_node->next;
+	now = g_get_monotonic_time();
 
-				del_node = cur_node;
-			} else {
-				prv_node = cur_node;
-			}
+	while ((node = g_queue_peek_head(storage->move_file_queue)) != NULL) {
+		if (now - node->time < (gint64)MS_MOVE_WAIT_TIME * 1000)
+			break;
 
-			cur_node = cur_node->next;
+		node = _ms_inoti_take_move_file(storage, node->cookie);
 
-			if (del_node != NULL) {
-				MS_SAFE_FREE(del_node->name);
-				MS_SAFE_FREE(del_node);
-			}
+		MS_DBG("moved out : %s", node->path);
+		if (node->is_dir) {
+			_ms_inoti_fence_dir(storage, node->wd, node->path);
+			_ms_inoti_delete_folder(storage, node->path);
+		} else if (!_ms_inoti_scan_pending(storage, node->wd)) {
+			_ms_inoti_add_job(_ms_inoti_get_shard(storage, node->wd), MS_INOTI_JOB_DELETE,
+					node->wd, NULL, node->path, NULL);
 		}
+
+		_ms_inoti_free_move_file(node);
 	}
+}
 
-	/*active flush */
-	 malloc_trim(0);
+/*smaller timeout of poll(), -1 means infinite*/
+static int _ms_inoti_min_timeout(int timeout1, int timeout2)
+{
+	if (timeout1 < 0)
+		return timeout2;
+	if (timeout2 < 0)
+		return timeout1;
+
+	return (timeout1 < timeout2) ? timeout1 : timeout2;
 }
 
-void ms_inoti_remove_watch(char *path)
+/*check mtime of polled directories, changed directory is rescanned*/
+static void _ms_inoti_poll_dir(ms_inoti_storage_info *storage)
 {
-	ms_inoti_dir_data *del_node = NULL;
-	ms_inoti_dir_data *prv_node = NULL;
+	GList *nodes;
+	GList *iter;
+	GList *changed = NULL;
+	struct stat st;
+	ms_poll_dir_info *node;
+	time_t since;
+	int count = 0;
+
+	g_mutex_lock(poll_dir_mutex);
+
+	if (storage->poll_dir_time == 0 || g_get_monotonic_time() < storage->poll_dir_time) {
+		g_mutex_unlock(poll_dir_mutex);
+		return;
+	}
 
-	if (strcmp(first_inoti_node->name, path) == 0) {
-		del_node = first_inoti_node;
-		first_inoti_node = first_inoti_node->next;
-	} else {
-		/*find same folder */
-		if (first_inoti_node != NULL) {
-			del_node = first_inoti_node;
-			while (del_node != NULL) {
-				MS_DBG("current node %s", del_node->name);
-				if (strcmp(path, del_node->name) == 0) {
-					MS_DBG("find delete node: %s", del_node->name);
-					if (prv_node != NULL) {
-						MS_DBG("previous_node : %s", prv_node->name);
-						prv_node->next = del_node->next;
-					}
-					/*free deleted node */
-					MS_SAFE_FREE(del_node->name);
-					MS_SAFE_FREE(del_node);
-					break;
-				}
-				prv_node = del_node;
-				del_node = del_node->next;
-			}
+	nodes = g_hash_table_get_values(poll_dir_table);
+	for (iter = nodes; iter != NULL; iter = iter->next) {
+		node = iter->data;
+		if (_ms_inoti_get_storage(node->path) != storage)
+			continue;
+
+		if (stat(node->path, &st) != 0) {
+			/*directory is removed, its parent handles it*/
+			g_hash_table_remove(poll_dir_table, node->path);
+			continue;
+		}
+
+		if (st.st_mtime != node->mtime) {
+			changed = g_list_prepend(changed, node);
+			g_hash_table_steal(poll_dir_table, node->path);
+		} else {
+			count++;
 		}
 	}
+	g_list_free(nodes);
 
-	/*active flush */
-	malloc_trim(0);
-}
+	/*changed directories which are not promoted set the time again*/
+	storage->poll_dir_time = (count > 0) ? g_get_monotonic_time() + (gint64)MS_POLL_DIR_TIME * G_USEC_PER_SEC : 0;
 
-void ms_inoti_modify_watch(char *path_from, char *path_to)
-{
-	bool find = false;
-	ms_inoti_dir_data *mod_node;
+	g_mutex_unlock(poll_dir_mutex);
 
-	if (strcmp(first_inoti_node->name, path_from) == 0) {
-		mod_node = first_inoti_node;
-	} else {
-		/*find same folder */
-		if (first_inoti_node != NULL) {
-			mod_node = first_inoti_node;
-			while (mod_node != NULL) {
-				/*find previous directory*/
-				if (strcmp(path_from, mod_node->name) == 0) { 
-					/*change path of directory*/
-					/*free previous name of node */
-					MS_SAFE_FREE(mod_node->name);
-
-					/*add new name */
-					mod_node->name = strdup(path_to);
-
-					/*active flush */
-					malloc_trim(0);
-
-					find = true;
-					break;
-				}
-				mod_node = mod_node->next;
-			}
+	for (iter = changed; iter != NULL; iter = iter->next) {
+		node = iter->data;
+		since = node->mtime;
+
+		/*changed directory is hot, it gets a watch if there is budget*/
+		if (_ms_inoti_get_watch_count() < _ms_inoti_get_watch_budget()) {
+			MS_DBG("promote poll dir : %s", node->path);
+			ms_inoti_add_watch(node->path);
+		} else {
+			_ms_inoti_add_poll_dir(node->path);
 		}
-	}
 
-	/*this is new directory*/
-	if (find == false) {
-		ms_inoti_add_watch(path_to);
+		ms_scan_request(node->path, MS_SCAN_DIRECTORY, since - 1);
+		_ms_inoti_free_poll_dir(node);
 	}
+	g_list_free(changed);
 }
 
+/*data is storage type, each storage runs this loop on its own instance*/
 gboolean ms_inoti_thread(void *data)
 {
 	uint32_t i;
 	int length;
 	int err;
-	int prev_mask = 0;
-	int prev_wd = -1;
+	int timeout;
+	int fd;
+	int wd;
 	bool res;
 	char name[MS_FILE_NAME_LEN_MAX + 1] = { 0 };
-	char prev_name[MS_FILE_NAME_LEN_MAX + 1] = { 0 };
 	char buffer[INOTI_BUF_LEN] = { 0 };
 	char path[MS_FILE_PATH_LEN_MAX] = { 0 };
 	struct inotify_event *event;
-	void **handle = NULL;
-
-	MS_DBG("START INOTIFY");
-
-	err = ms_connect_db(&handle);
+	struct epoll_event events[MS_INOTI_EPOLL_EVENT_MAX];
+	int count;
+	int n;
+	int watch_fd = -1;	/*instance in epoll set*/
+	int close_fd;
+	bool readable;
+	bool pending;	/*directory of event is not read by the running scan yet*/
+	bool lost;	/*renamed directory has no watch, its walk ran after it was renamed*/
+	uint64_t value;
+	time_t now;
+	ms_move_file_info *move_node;
+	ms_inoti_shard_info *shard;
+	ms_inoti_storage_info *storage = &inoti_storage[GPOINTER_TO_INT(data)];
+
+	MS_DBG("START INOTIFY : %s", storage->root);
+
+	err = ms_connect_db(&storage->handle);
 	if (err != MS_ERR_NONE) {
 		MS_DBG_ERR(" INOTIFY : sqlite3_open: ret = %d", err);
 		return false;
 	}
 
+	/*file events are indexed by shards, this loop keeps directory events*/
+	_ms_inoti_start_shards(storage);
+
 	while (1) {
 		i = 0;
-		length = read(inoti_fd, buffer, sizeof(buffer) - 1);
+
+		/*instance of detached storage is closed here, nobody waits it any more*/
+		g_mutex_lock(storage->mutex);
+		close_fd = storage->close_fd;
+		storage->close_fd = -1;
+		fd = storage->fd;
+		g_mutex_unlock(storage->mutex);
+
+		/*shards add watches under storage mutex, they are waited without it*/
+		if (close_fd >= 0) {
+			if (close_fd == watch_fd) {
+				epoll_ctl(storage->epoll_fd, EPOLL_CTL_DEL, watch_fd, NULL);
+				watch_fd = -1;
+			}
+			close(close_fd);
+			_ms_inoti_clear_storage(storage);
+		}
+
+		if (fd != watch_fd) {
+			if (watch_fd >= 0)
+				epoll_ctl(storage->epoll_fd, EPOLL_CTL_DEL, watch_fd, NULL);
+			watch_fd = -1;
+			if (fd >= 0 && _ms_inoti_epoll_add(storage, fd) == MS_ERR_NONE)
+				watch_fd = fd;
+		}
+
+		/*wait IN_MOVED_TO only for a while, after that IN_MOVED_FROM is handled alone*/
+		timeout = _ms_inoti_min_timeout(_ms_inoti_get_move_file_timeout(storage),
+						_ms_inoti_get_active_dir_timeout(storage));
+		timeout = _ms_inoti_min_timeout(timeout, _ms_inoti_get_poll_dir_timeout(storage));
+		_ms_inoti_set_timer(storage, timeout);
+
+		count = epoll_wait(storage->epoll_fd, events, MS_INOTI_EPOLL_EVENT_MAX, -1);
+
+		if (power_off) {
+			MS_DBG("power off");
+			goto POWER_OFF;
+		}
+
+		if (count < 0) {
+			if (errno != EINTR)
+				MS_DBG_ERR("epoll_wait failed : %s", strerror(errno));
+			continue;
+		}
+
+		readable = false;
+		for (n = 0; n < count; n++) {
+			if (events[n].data.fd == storage->event_fd) {
+				/*storage is attached or detached*/
+				eventfd_read(storage->event_fd, &value);
+			} else if (events[n].data.fd == storage->timer_fd) {
+				if (read(storage->timer_fd, &value, sizeof(value)) < 0)
+					MS_DBG_ERR("read failed : %s", strerror(errno));
+			} else if (events[n].data.fd == watch_fd) {
+				readable = true;
+			}
+		}
+
+		if (!readable) {
+			/*deadline is passed*/
+			_ms_inoti_expire_active_dir(storage);
+			_ms_inoti_poll_dir(storage);
+			_ms_inoti_expire_move_file(storage);
+			_ms_inoti_dispatch_jobs(storage);
+			continue;
+		}
+
+		if (fanoti_enabled)
+			length = ms_fanoti_read(storage->storage_type, fd, buffer, sizeof(buffer) - 1);
+		else
+			length = read(fd, buffer, sizeof(buffer) - 1);
 
 		if (length < 0 || length > sizeof(buffer)) {	/*this is error */
 			continue;
 		}
 
+		now = time(NULL);
+		_ms_inoti_expire_active_dir(storage);
+
 		while (i < length && i < INOTI_BUF_LEN) {
 			/*check poweroff status*/
 			if(power_off) {
@@ -507,9 +2360,17 @@ gboolean ms_inoti_thread(void *data)
 			/*it's possible that ums lets reset phone data... */
 			event = (struct inotify_event *)&buffer[i];
 
-			if (strcmp(event->name, POWEROFF_DIR_NAME) == 0) {
-				MS_DBG("power off");
-				goto POWER_OFF;
+			if (event->mask & IN_Q_OVERFLOW) {
+				/*some events are lost, rescan directories of them*/
+				MS_DBG_ERR("inotify event queue overflow");
+				_ms_inoti_request_rescan(storage);
+				goto NEXT_INOTI_EVENT;
+			} else if (event->len == 0) {
+				/*This is ignore case*/
+				if (event->mask & IN_IGNORED) {
+					MS_DBG("This case is ignored");
+				}
+				goto NEXT_INOTI_EVENT;
 			} else if(strcmp(event->name, "_FILEOPERATION_END") == 0) {
 				/*file operation is end*/
 				/* announce db is updated*/
@@ -525,8 +2386,16 @@ gboolean ms_inoti_thread(void *data)
 				goto NEXT_INOTI_EVENT;
 			}
 
+			/*wd of registry*/
+			wd = fanoti_enabled ? event->wd : MS_INOTI_WD_KEY(storage->storage_type, event->wd);
+
+			if (_ms_inoti_mark_active_dir(storage, wd, now) && _ms_inoti_rescan_covers(storage, event)) {
+				/*flooded directory is rescanned later*/
+				goto NEXT_INOTI_EVENT;
+			}
+
 			/*start of one event */
-			if (event->len && (event->len <= MS_FILE_NAME_LEN_MAX)) {
+			if (event->len <= MS_FILE_NAME_LEN_MAX) {
 				/*Add for fixing prevent defect 2011-02-15 */
 				err = ms_strcopy(name, sizeof(name), "%s", event->name);
 				if (err != MS_ERR_NONE) {
@@ -535,347 +2404,202 @@ gboolean ms_inoti_thread(void *data)
 				}
 
 				/*get full path of file or directory */
-				res = _ms_inoti_get_full_path(event->wd, name, path, sizeof(path));
+				res = _ms_inoti_get_full_path(wd, name, path, sizeof(path));
 				if (res == false) {
 					MS_DBG_ERR("_ms_inoti_get_full_path error");
 					goto NEXT_INOTI_EVENT;
 				}
 
-				MS_DBG("INOTIFY[%d : %s]", event->wd, name);
+				MS_DBG("INOTIFY[%d : %s]", wd, name);
 				if (event->mask & IN_ISDIR) {
 					MS_DBG("DIRECTORY INOTIFY");
-					
+
 					if (event->mask & IN_MOVED_FROM) {
 						MS_DBG("MOVED_FROM");
 
-						prev_mask = event->mask;
-						prev_wd = event->wd;
-
-						err = ms_strcopy(prev_name, sizeof(prev_name), "%s", event->name);
-						if (err != MS_ERR_NONE) {
-							MS_DBG_ERR("ms_strcopy fail");
-							goto NEXT_INOTI_EVENT;
-						}
-					} 
+						_ms_inoti_add_move_file(storage, event->cookie, wd, path, true);
+					}
 					else if (event->mask & IN_MOVED_TO) {
 						MS_DBG("MOVED_TO");
 
-						char full_path_from[MS_FILE_PATH_LEN_MAX] = { 0 };
+						move_node = _ms_inoti_take_move_file(storage, event->cookie);
+						if (move_node != NULL) {
+							/*file actions under the directory must be done before it changes*/
+							_ms_inoti_fence_dir(storage, move_node->wd, move_node->path);
+
+							pending = _ms_inoti_scan_pending(storage, _ms_inoti_get_watch_wd(move_node->path));
+							/*walk of created directory found nothing on its old path*/
+							lost = (_ms_inoti_get_watch_wd(move_node->path) < 0
+									&& !_ms_inoti_find_poll_dir(move_node->path));
+
+							/*renamed node carries watches of all sub directories*/
+							MS_DBG("Modify added watch");
+							ms_inoti_modify_watch(move_node->path, path);
+
+							/*need update file information under renamed directory */
+							_ms_inoti_move_folder(storage->handle, move_node->path, path);
+
+							if (pending || lost) {
+								/*scan looks for the old path, files of renamed directory are registered here*/
+								if (pending)
+									_ms_inoti_set_watch_epoch(path, 0, true);
+								_ms_inoti_add_job(_ms_inoti_get_shard(storage, wd), MS_INOTI_JOB_SCAN_DIR,
+										wd, NULL, path, NULL);
+							}
 
-						res = _ms_inoti_get_full_path(prev_wd, prev_name, full_path_from, sizeof(full_path_from));
-						if (res == false) {
-							MS_DBG_ERR("_ms_inoti_get_full_path error");
-							goto NEXT_INOTI_EVENT;
+							_ms_inoti_free_move_file(move_node);
+						} else {
+							/*moved from outside of watched directories*/
+							_ms_inoti_add_job(_ms_inoti_get_shard(storage, wd), MS_INOTI_JOB_SCAN_DIR,
+									wd, NULL, path, NULL);
 						}
-						/*enable bundle commit*/
-						ms_move_start(handle);
-
-						/*need update file information under renamed directory */
-						_ms_inoti_scan_renamed_folder(handle, full_path_from, path);
-
-						/*disable bundle commit*/
-						ms_move_end(handle);
-
-						prev_mask = prev_wd = 0;	/*reset */
 					}
 					else if (event->mask & IN_CREATE) {
 						MS_DBG("CREATE");
 
-						_ms_inoti_directory_scan_and_register_file(handle, path);
-						prev_mask = event->mask;
+						_ms_inoti_add_job(_ms_inoti_get_shard(storage, wd), MS_INOTI_JOB_SCAN_DIR,
+								wd, NULL, path, NULL);
 					}
 					else if (event->mask & IN_DELETE) {
 						MS_DBG("DELETE");
 
-						ms_inoti_remove_watch(path);
+						/*file actions under the directory must be done before it is deleted*/
+						_ms_inoti_fence_dir(storage, wd, path);
+						_ms_inoti_delete_folder(storage, path);
 					}
 				}
 				else {
 					MS_DBG("FILE INOTIFY");
+					shard = _ms_inoti_get_shard(storage, wd);
+					pending = _ms_inoti_scan_pending(storage, wd);
 
 					if (event->mask & IN_MOVED_FROM) {
 						MS_DBG("MOVED_FROM");
 
-						err = ms_delete_item(handle, path);
-						if (err != MS_ERR_NONE) {
-							MS_DBG_ERR("ms_media_db_delete fail error : %d", err);
-						}
+						_ms_inoti_add_move_file(storage, event->cookie, wd, path, false);
+					}
+					else if (pending && !(event->mask & IN_MOVED_TO)) {
+						/*scan reads this directory later and sees the result of this event*/
+						MS_DBG("scan has not reached : %s", path);
 					}
 					else if (event->mask & IN_MOVED_TO) {
 						MS_DBG("MOVED_TO");
 
-						err = ms_register_file(handle, path, NULL);
-						if (err != MS_ERR_NONE) {
-							MS_DBG_ERR("ms_register_file error : %d", err);
+						move_node = _ms_inoti_take_move_file(storage, event->cookie);
+						if (move_node != NULL) {
+							/*only the side which scan has already read is applied*/
+							if (!_ms_inoti_scan_pending(storage, move_node->wd)) {
+								if (pending)
+									_ms_inoti_add_job(_ms_inoti_get_shard(storage, move_node->wd),
+											MS_INOTI_JOB_DELETE, move_node->wd, NULL, move_node->path, NULL);
+								else
+									_ms_inoti_dispatch_move(storage, move_node->wd, wd, move_node->path, path);
+							} else if (!pending) {
+								_ms_inoti_add_job(shard, MS_INOTI_JOB_INSERT, wd, NULL, path, NULL);
+							}
+							_ms_inoti_free_move_file(move_node);
+						} else if (pending) {
+							MS_DBG("scan has not reached : %s", path);
+						} else {
+							/*moved from outside of watched directories*/
+							_ms_inoti_add_job(shard, MS_INOTI_JOB_INSERT, wd, NULL, path, NULL);
 						}
 					}
 					else if (event->mask & IN_CREATE) {
 						MS_DBG("CREATE");
 
-						_ms_inoti_add_create_file_list(event->wd, name);
+						_ms_inoti_add_job(shard, MS_INOTI_JOB_CREATE, wd, name, path, NULL);
 					}
 					else if (event->mask & IN_DELETE) {
 						MS_DBG("DELETE");
-						
-						err = ms_delete_item(handle, path);
-						if (err != MS_ERR_NONE) {
-							MS_DBG_ERR("ms_media_db_delete error : %d", err);
-						}
+
+						_ms_inoti_add_job(shard, MS_INOTI_JOB_DELETE, wd, NULL, path, NULL);
 					}
 					else if (event->mask & IN_CLOSE_WRITE) {
 						MS_DBG("CLOSE_WRITE");
-						ms_create_file_info *node;
 
-						node = _ms_inoti_find_create_file_list (event->wd, name);
-						if (node != NULL || ((prev_mask & IN_ISDIR) & IN_CREATE)) {
-							err = ms_register_file(handle, path, NULL);
-							if (err != MS_ERR_NONE) {
-								MS_DBG_ERR("ms_register_file error : %d", err);
-							}
-							if (node != NULL)
-								_ms_inoti_delete_create_file_list(node);
-						}
-						else {
-							ms_ignore_file_info  *ignore_file;
-
-							ignore_file = ms_inoti_find_ignore_file(path);
-							if (ignore_file == NULL) {
-								/*in case of replace */
-								MS_DBG("This case is replacement or changing meta data.");
-								err = ms_refresh_item(handle, path);
-								if (err != MS_ERR_NONE) {
-									MS_DBG_ERR("ms_refresh_item error : %d", err);
-									goto NEXT_INOTI_EVENT;
-								}
-							} else {
-								/*This is ignore case*/
-							}
-						}
-						prev_mask = prev_wd = 0;	/*reset */
+						_ms_inoti_add_job(shard, MS_INOTI_JOB_CLOSE_WRITE, wd, name, path, NULL);
 					}
 				}
 			} /*end of one event */
-			else {
-				/*This is ignore case*/
-				if (event->mask & IN_IGNORED) {
-					MS_DBG("This case is ignored");
-				}
-			}
  NEXT_INOTI_EVENT:	;
 			i += INOTI_EVENT_SIZE + event->len;
 		}
 
+		_ms_inoti_expire_move_file(storage);
+		_ms_inoti_dispatch_jobs(storage);
+		_ms_inoti_poll_dir(storage);
+
+		_ms_inoti_print_stats(storage);
+
 		/*Active flush */
 		malloc_trim(0);
 	}
 POWER_OFF:
-	ms_inoti_remove_watch(MS_DB_UPDATE_NOTI_PATH);
+	_ms_inoti_clear_move_file(storage);
+
+	_ms_inoti_stop_shards(storage);
+
+	g_hash_table_remove_all(storage->active_dir_table);
+	storage->hot_dir_count = 0;
+
+	if (storage->storage_type == MS_STORAGE_INTERNAL)
+		ms_inoti_remove_watch(MS_DB_UPDATE_NOTI_PATH);
 
-	ms_inoti_remove_watch_recursive(MS_ROOT_PATH_INTERNAL);
-	ms_inoti_remove_watch_recursive(MS_ROOT_PATH_EXTERNAL);
+	ms_inoti_remove_watch_recursive((char *)storage->root);
 
-	close(inoti_fd);
+	g_mutex_lock(storage->mutex);
+	if (storage->fd >= 0)
+		close(storage->fd);
+	if (storage->close_fd >= 0)
+		close(storage->close_fd);
+	storage->fd = -1;
+	storage->close_fd = -1;
+	g_mutex_unlock(storage->mutex);
 
-	if (handle) ms_disconnect_db(&handle);
+	close(storage->timer_fd);
+	close(storage->event_fd);
+	storage->event_fd = -1;
+	close(storage->epoll_fd);
+
+	if (storage->handle) ms_disconnect_db(&storage->handle);
 
 	return false;
 }
 
-int _ms_get_path_from_current_node(int find_folder,
-				   ms_dir_scan_info **current_root,
-				   ms_dir_scan_info **real_root, char **path, int *depth)
+static ms_walk_result_t _ms_inoti_watch_dir(const char *path, void *user_data)
 {
-	int err = MS_ERR_NONE;
-	char get_path[FAT_FILEPATH_LEN_MAX] = { 0 };
+	ms_storage_type_t storage_type = GPOINTER_TO_INT(user_data);
 
-	if (find_folder == 0) {
-		if ((*current_root)->Rbrother != NULL) {
-			*current_root = (*current_root)->Rbrother;
-		} else {
-			while (1) {
-				if ((*current_root)->parent == *real_root
-				    || (*current_root)->parent == NULL) {
-					*current_root = NULL;
-					*depth = 0;
-					return MS_ERR_NONE;
-				} else if ((*current_root)->parent->Rbrother == NULL) {
-					*current_root = (*current_root)->parent;
-					(*depth) --;
-				} else {
-					*current_root = (*current_root)->parent->Rbrother;
-					(*depth) --;
-					break;
-				}
-			}
-		}
-		(*depth) --;
+	/*check poweroff status*/
+	if (power_off) {
+		MS_DBG("Power off");
+		return MS_WALK_STOP;
 	}
 
-	err = ms_get_full_path_from_node(*current_root, get_path, *depth);
-	if (err != MS_ERR_NONE)
-		return MS_ERR_INVALID_DIR_PATH;
+	/*check SD card in out*/
+	if ((mmc_state != VCONFKEY_SYSMAN_MMC_MOUNTED) && (storage_type == MS_STORATE_EXTERNAL))
+		return MS_WALK_STOP;
 
-	*path = strdup(get_path);
+	_ms_inoti_add_watch_path(path);
 
-	return err;
+	return MS_WALK_CONTINUE;
 }
 
 void ms_inoti_add_watch_all_directory(ms_storage_type_t storage_type)
 {
-	int err = 0;
-	int depth = 0;
-	int find_folder = 0;
-	char get_path[MS_FILE_PATH_LEN_MAX] = { 0 };
-	char *path = NULL;
-	DIR *dp = NULL;
-	struct dirent entry;
-	struct dirent *result;
-
-	ms_dir_scan_info *root;
-	ms_dir_scan_info *tmp_root = NULL;
-	ms_dir_scan_info *cur_node = NULL; /*current node*/
-	ms_dir_scan_info *prv_node = NULL; /*previous node*/
-	ms_dir_scan_info *next_node = NULL;
-
-	root = malloc(sizeof(ms_dir_scan_info));
-	if (root == NULL) {
-		MS_DBG_ERR("malloc fail");
-		return;
-	}
-
-	if (storage_type == MS_STORAGE_INTERNAL)
-		root->name = strdup(MS_ROOT_PATH_INTERNAL);
-	else
-		root->name = strdup(MS_ROOT_PATH_EXTERNAL);
-	if (root->name  == NULL) {
-		MS_DBG_ERR("strdup fail");
-		free(root);
-		return;
-	}
-
-	root->parent = NULL;
-	root->Rbrother = NULL;
-	root->next = NULL;
-	tmp_root = root;
-	prv_node = root;
+	int err;
+	const char *root;
 
-	path = malloc(sizeof(char) * MS_FILE_PATH_LEN_MAX);
+	root = (storage_type == MS_STORAGE_INTERNAL) ? MS_ROOT_PATH_INTERNAL : MS_ROOT_PATH_EXTERNAL;
 
-	err = ms_get_full_path_from_node(tmp_root, path, depth);
-	if (err != MS_ERR_NONE) {
+	if (fanoti_enabled) {
+		/*one mark covers all directories*/
+		_ms_inoti_add_watch_path(root);
 		return;
 	}
 
-	ms_inoti_add_watch_with_node(root, depth);
-
-	while (1) {
-		/*check poweroff status*/
-		if (power_off) {
-			MS_DBG("Power off");
-			goto FREE_RESOURCES;
-		}
-
-		/*check SD card in out*/
-		if ((mmc_state != VCONFKEY_SYSMAN_MMC_MOUNTED) && (storage_type == MS_STORATE_EXTERNAL))
-			goto FREE_RESOURCES;
-
-		depth ++;
-		dp = opendir(path);
-		if (dp == NULL) {
-			MS_DBG_ERR("%s folder opendir fails", path);
-			goto NEXT_DIR;
-		}
-
-		while (!readdir_r(dp, &entry, &result)) {
-			/*check poweroff status*/
-			if (power_off) {
-				MS_DBG("Power off");
-				goto FREE_RESOURCES;
-			}
-
-			if (result == NULL)
-				break;
-
-			if (entry.d_name[0] == '.')
-				continue;
-
-			/*check SD card in out*/
-			if ((mmc_state != VCONFKEY_SYSMAN_MMC_MOUNTED) && (storage_type == MS_STORATE_EXTERNAL)) {
-				goto FREE_RESOURCES;
-			}
-
-			if (entry.d_type & DT_DIR) {
-				DIR *tmp_dp = NULL;
-				err = ms_strappend(get_path, sizeof(get_path), "%s/%s",path, entry.d_name);
-				if (err != MS_ERR_NONE) {
-					MS_DBG_ERR("ms_strappend error");
-					continue;
-				}
-
-				tmp_dp = opendir(get_path);
-				if (tmp_dp == NULL) {
-					MS_DBG_ERR("%s folder opendir fails", get_path);
-					MS_DBG("error : %d, %s", errno ,strerror(errno));
-					continue;
-				}
-				else
-					closedir(tmp_dp);
-
-				cur_node = malloc(sizeof(ms_dir_scan_info));
-				if (cur_node == NULL) {
-					MS_DBG_ERR("malloc fail");
-
-					goto FREE_RESOURCES;
-				}
-
-				cur_node->name = strdup(entry.d_name);
-				cur_node->Rbrother = NULL;
-				cur_node->next = NULL;
-
-				/*1. 1st folder */
-				if (find_folder == 0) {
-					cur_node->parent = tmp_root;
-					tmp_root = cur_node;
-				} else {
-					cur_node->parent = tmp_root->parent;
-					prv_node->Rbrother = cur_node;
-				}
-				prv_node->next = cur_node;
-
-				/*add watch */
-				ms_inoti_add_watch_with_node(cur_node, depth);
-
-				/*change previous */
-				prv_node = cur_node;
-				find_folder++;
-			}
-		}
-NEXT_DIR:
-		if (dp) closedir(dp);
-		if (path) free(path);
-		dp = NULL;
-		path = NULL;
-
-		err = _ms_get_path_from_current_node(find_folder, &tmp_root, &root, &path, &depth);
-		if (err != MS_ERR_NONE)
-			break;
-
-		if (tmp_root == NULL)
-			break;
-
-		find_folder = 0;
-	}
-
-FREE_RESOURCES:
-	/*free allocated memory */
-	if (path) free(path);
-	if (dp) closedir(dp);
-
-	cur_node = root;
-	while (cur_node != NULL) {
-		next_node = cur_node->next;
-		free(cur_node->name);
-		free(cur_node);
-		cur_node = next_node;
-	}
-}
\ No newline at end of file
+	err = ms_walk_dir(root, _ms_inoti_watch_dir, NULL, GINT_TO_POINTER(storage_type));
+	if (err != MS_ERR_NONE)
+		MS_DBG_ERR("ms_walk_dir error : %d", err);
+}
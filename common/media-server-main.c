@@ -45,11 +45,9 @@
 static int heynoti_id;
 
 extern GAsyncQueue *scan_queue;
-extern GAsyncQueue* ret_queue;
 extern GMutex *db_mutex;
-extern GMutex *list_mutex;
-extern GMutex *queue_mutex;
-extern GArray *reg_list;
+extern GMutex *work_mutex;
+extern GHashTable *work_table;
 extern int mmc_state;
 extern bool power_off; /*If this is TRUE, poweroff notification received*/
 static GMainLoop *mainloop = NULL;
@@ -128,8 +126,7 @@ static void _power_off_cb(void* data)
 		g_async_queue_push(scan_queue, GINT_TO_POINTER(scan_data));
 
 		/*notify to Inotify thread*/
-		mkdir(POWEROFF_DIR_PATH, 0777);
-		rmdir(POWEROFF_DIR_PATH);
+		ms_inoti_stop();
 	}
 
 	if (g_main_loop_is_running(mainloop)) g_main_loop_quit(mainloop);
@@ -164,7 +161,7 @@ static bool _db_clear(void** handle)
 
 int main(int argc, char **argv)
 {
-	GThread *inoti_tid = NULL;
+	GThread *inoti_tid[MS_INOTI_STORAGE_NUM] = { NULL };
 	GThread *scan_tid = NULL;
 	GSource *source = NULL;
 	GIOChannel *channel = NULL;
@@ -173,6 +170,7 @@ int main(int argc, char **argv)
 	pid_t current_pid = 0;
 	int sockfd = -1;
 	int err;
+	int i;
 	bool check_result = false;
 	bool need_db_create;
 	void **handle = NULL;
@@ -215,9 +213,8 @@ int main(int argc, char **argv)
 	if (!db_mutex) db_mutex = g_mutex_new();
 
 	/*Init for register file*/
-	if (!list_mutex) list_mutex = g_mutex_new();
-	if (!queue_mutex) queue_mutex = g_mutex_new();
-	if (!reg_list) reg_list = g_array_new(TRUE, TRUE, sizeof(char*));
+	if (!work_mutex) work_mutex = g_mutex_new();
+	if (!work_table) work_table = g_hash_table_new(g_str_hash, g_str_equal);
 
 	/*connect to media db, if conneting is failed, db updating is stopped*/
 	ms_connect_db(&handle);
@@ -228,11 +225,15 @@ int main(int argc, char **argv)
 	ms_dbus_init();
 
 	ms_inoti_add_watch(MS_DB_UPDATE_NOTI_PATH);
-	ms_inoti_add_watch_all_directory(MS_STORAGE_INTERNAL);
+
+	/*full scan adds watches of sub directories while it reads them*/
+	if (need_db_create)
+		ms_inoti_add_watch(MS_ROOT_PATH_INTERNAL);
+	else
+		ms_inoti_add_watch_all_directory(MS_STORAGE_INTERNAL);
 
 	/*These are a communicator for thread*/
 	if (!scan_queue) scan_queue = g_async_queue_new();
-	if (!ret_queue) ret_queue = g_async_queue_new();
 
 	/*prepare socket*/
 	/* Create and bind new UDP socket */
@@ -251,7 +252,8 @@ int main(int argc, char **argv)
 	}
 
 	/*create each threads*/
-	inoti_tid = g_thread_create((GThreadFunc) ms_inoti_thread, NULL, TRUE, NULL);
+	for (i = 0; i < MS_INOTI_STORAGE_NUM; i++)
+		inoti_tid[i] = g_thread_create((GThreadFunc) ms_inoti_thread, GINT_TO_POINTER(i), TRUE, NULL);
 	scan_tid = g_thread_create((GThreadFunc) ms_scan_thread, NULL, TRUE, NULL);
 
 	/*set vconf callback function*/
@@ -281,8 +283,11 @@ int main(int argc, char **argv)
 		if (!ms_drm_insert_ext_memory())
 			MS_DBG_ERR("ms_drm_insert_ext_memory failed");
 
+		ms_inoti_attach_storage(MS_STORATE_EXTERNAL);
 		ms_make_default_path_mmc();
-		ms_inoti_add_watch_all_directory(MS_STORATE_EXTERNAL);
+
+		/*storage scan adds watches of sub directories while it reads them*/
+		ms_inoti_add_watch(MS_ROOT_PATH_EXTERNAL);
 
 		mmc_scan_data->path = strdup(MS_ROOT_PATH_EXTERNAL);
 		mmc_scan_data->scan_type = ms_get_mmc_state();
@@ -300,7 +305,8 @@ int main(int argc, char **argv)
 
 	g_main_loop_run(mainloop);
 
-	g_thread_join(inoti_tid);
+	for (i = 0; i < MS_INOTI_STORAGE_NUM; i++)
+		g_thread_join(inoti_tid[i]);
 	g_thread_join(scan_tid);
 
 	/*close an IO channel*/
@@ -311,8 +317,7 @@ int main(int argc, char **argv)
 	heynoti_close(heynoti_id);
 
 	if (scan_queue) g_async_queue_unref(scan_queue);
-	if (ret_queue) g_async_queue_unref(ret_queue);
-	if (reg_list) g_array_free(reg_list, true);
+	if (work_table) g_hash_table_destroy(work_table);
 
 	/***********
 	**remove call back functions
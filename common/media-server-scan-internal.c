@@ -31,369 +31,832 @@
 
 #include "media-server-utils.h"
 #include "media-server-db-svc.h"
+#include "media-server-dir-walk.h"
 #include "media-server-inotify.h"
 #include "media-server-scan-internal.h"
 
 extern int mmc_state;
 bool power_off;
 
-typedef struct ms_scan_data {
-	char *name;
-	struct ms_scan_data *next;
-} ms_scan_data;
+#define MS_SCAN_WORKER_MAX 4 /*each stage of a storage scan runs this many threads at most*/
+#define MS_SCAN_BATCH_SIZE 64 /*files passed from a stage to the next at once*/
+#define MS_SCAN_PIPE_MAX 16 /*batches waiting between two stages, the former stage waits when it is full*/
+#define MS_SCAN_COMMIT_COUNT 512 /*inserted files stay in work until commit, full scan commits this often*/
+
+/*bounded queue of batches between two stages of a scan*/
+typedef struct ms_scan_pipe {
+	GMutex *mutex;	/*protects below*/
+	GCond *not_empty;
+	GCond *not_full;
+	GQueue *batches;
+	int producers;	/*threads pushing batches, the pipe is closed when all of them are done*/
+} ms_scan_pipe;
+
+/*file which the classification stage passes to the persistence stage*/
+typedef struct ms_scan_item {
+	char *path;
+	char mimetype[255];
+	bool drm;
+} ms_scan_item;
+
+/*throughput of a stage thread*/
+typedef struct ms_scan_stat {
+	int file_count;
+	gint64 busy_time;	/*usec of working*/
+	gint64 wait_time;	/*usec of waiting for pipes*/
+} ms_scan_stat;
+
+struct ms_scan_job;
+
+/*enumeration stage : each worker reads directories of its own queue, and steals the oldest one of others when it is empty*/
+typedef struct ms_scan_worker {
+	struct ms_scan_job *job;
+	int index;
+	GThread *thread;
+	GMutex *mutex;	/*protects dirs*/
+	GQueue *dirs;	/*paths of directories to read, owner takes the newest and thieves take the oldest*/
+	GPtrArray *files;	/*paths of files not passed to the classification stage yet*/
+	int dir_count;
+	int steal_count;
+	ms_scan_stat stat;
+} ms_scan_worker;
+
+/*classification stage : mime type and drm of files are probed out of DB transaction*/
+typedef struct ms_scan_classifier {
+	struct ms_scan_job *job;
+	int index;
+	GThread *thread;
+	ms_scan_stat stat;
+} ms_scan_classifier;
+
+typedef struct ms_scan_job {
+	ms_storage_type_t storage_type;
+	ms_dir_scan_type_t scan_type;
+	ms_scan_worker *workers;
+	ms_scan_classifier *classifiers;
+	int worker_count;	/*threads of enumeration stage, and of classification stage*/
+	ms_scan_pipe classify_pipe;	/*paths of files from enumeration stage*/
+	ms_scan_pipe persist_pipe;	/*items from classification stage*/
+	GMutex *mutex;	/*protects below*/
+	GCond *cond;	/*directory is queued, or no directory is left*/
+	int queued;	/*directories in queues of workers*/
+	int pending;	/*directories queued or being read*/
+	int idle;	/*workers waiting cond*/
+	bool stop;
+} ms_scan_job;
+
+static bool _ms_scan_stopped(ms_storage_type_t storage_type)
+{
+	/*check poweroff status*/
+	if (power_off) {
+		MS_DBG("Power off");
+		return true;
+	}
 
-ms_scan_data *first_scan_node;
+	/*check SD card in out */
+	if ((mmc_state != VCONFKEY_SYSMAN_MMC_MOUNTED) && (storage_type == MS_STORATE_EXTERNAL)) {
+		MS_DBG("Directory scanning is stopped");
+		return true;
+	}
 
-static int _ms_scan_get_next_path_from_current_node(int find_folder,
-				   ms_dir_scan_info **current_root,
-				   ms_dir_scan_info **real_root, char **path, int *depth)
+	return false;
+}
+
+static int _ms_scan_get_worker_count(void)
 {
-	int err = MS_ERR_NONE;
-	char get_path[FAT_FILEPATH_LEN_MAX] = { 0 };
+	int count = 0;
 
-	if (find_folder == 0) {
-		if ((*current_root)->Rbrother != NULL) {
-			*current_root = (*current_root)->Rbrother;
-		} else {
-			while (1) {
-				if ((*current_root)->parent == *real_root
-				    || (*current_root)->parent == NULL) {
-					*current_root = NULL;
-					*depth = 0;
-					return MS_ERR_NONE;
-				} else if ((*current_root)->parent->Rbrother == NULL) {
-					*current_root = (*current_root)->parent;
-					(*depth) --;
-				} else {
-					*current_root = (*current_root)->parent->Rbrother;
-					(*depth) --;
-					break;
-				}
-			}
-		}
-		(*depth) --;
+	if (!ms_config_get_int(MS_SCAN_WORKER_KEY, &count) || count <= 0) {
+		/*one worker per core*/
+		count = sysconf(_SC_NPROCESSORS_ONLN);
 	}
+	if (count < 1)
+		count = 1;
+	if (count > MS_SCAN_WORKER_MAX)
+		count = MS_SCAN_WORKER_MAX;
 
-	err = ms_get_full_path_from_node(*current_root, get_path, *depth);
-	if (err != MS_ERR_NONE)
-		return MS_ERR_INVALID_DIR_PATH;
+	return count;
+}
 
-	*path = strdup(get_path);
+static void _ms_scan_free_paths(GPtrArray *paths)
+{
+	guint i;
+	char *path;
 
-	return err;
+	for (i = 0; i < paths->len; i++) {
+		path = g_ptr_array_index(paths, i);
+		MS_SAFE_FREE(path);
+	}
+	g_ptr_array_free(paths, TRUE);
 }
 
-static int _ms_scan_add_node(ms_dir_scan_info * const node, int depth)
+static void _ms_scan_free_items(GPtrArray *items)
 {
-	int err;
-	char full_path[MS_FILE_PATH_LEN_MAX] = { 0 };
-	ms_scan_data *current_dir = NULL;
-	ms_scan_data *prv_node = NULL;
-	ms_scan_data *last_node = NULL;
+	guint i;
+	ms_scan_item *item;
 
-	err = ms_get_full_path_from_node(node, full_path, depth);
-	if (err != MS_ERR_NONE)
-		return MS_ERR_INVALID_DIR_PATH;
+	for (i = 0; i < items->len; i++) {
+		item = g_ptr_array_index(items, i);
+		MS_SAFE_FREE(item->path);
+		MS_SAFE_FREE(item);
+	}
+	g_ptr_array_free(items, TRUE);
+}
 
-	last_node = first_scan_node;
-	while (last_node != NULL) {
-		last_node = last_node->next;
+static int _ms_scan_pipe_init(ms_scan_pipe *pipe, int producers)
+{
+	pipe->mutex = g_mutex_new();
+	pipe->not_empty = g_cond_new();
+	pipe->not_full = g_cond_new();
+	pipe->batches = g_queue_new();
+	pipe->producers = producers;
+	if (pipe->mutex == NULL || pipe->not_empty == NULL || pipe->not_full == NULL || pipe->batches == NULL) {
+		MS_DBG_ERR("scan pipe init fail");
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
 	}
 
-	/*find same folder */
-	if (first_scan_node != NULL) {
-		last_node = first_scan_node;
-		while (last_node != NULL) {
-			if (strcmp(full_path, last_node->name) == 0) {
-				return MS_ERR_NONE;
-			}
-			prv_node = last_node;
-			last_node = last_node->next;
-		}
+	return MS_ERR_NONE;
+}
+
+static void _ms_scan_pipe_free(ms_scan_pipe *pipe, void (*free_batch)(GPtrArray *))
+{
+	GPtrArray *batch;
+
+	if (pipe->batches != NULL) {
+		while ((batch = g_queue_pop_head(pipe->batches)) != NULL)
+			free_batch(batch);
+		g_queue_free(pipe->batches);
+	}
+	if (pipe->not_full != NULL)
+		g_cond_free(pipe->not_full);
+	if (pipe->not_empty != NULL)
+		g_cond_free(pipe->not_empty);
+	if (pipe->mutex != NULL)
+		g_mutex_free(pipe->mutex);
+}
+
+static void _ms_scan_pipe_push(ms_scan_pipe *pipe, GPtrArray *batch, ms_scan_stat *stat)
+{
+	gint64 start = 0;
+
+	g_mutex_lock(pipe->mutex);
+	if (g_queue_get_length(pipe->batches) >= MS_SCAN_PIPE_MAX) {
+		start = g_get_monotonic_time();
+		while (g_queue_get_length(pipe->batches) >= MS_SCAN_PIPE_MAX)
+			g_cond_wait(pipe->not_full, pipe->mutex);
+		stat->wait_time += g_get_monotonic_time() - start;
 	}
+	g_queue_push_tail(pipe->batches, batch);
+	g_cond_signal(pipe->not_empty);
+	g_mutex_unlock(pipe->mutex);
+}
 
-	current_dir = malloc(sizeof(ms_scan_data));
-	current_dir->name = strdup(full_path);
-	current_dir->next = NULL;
+/*returns NULL when the pipe is empty and closed*/
+static GPtrArray *_ms_scan_pipe_pop(ms_scan_pipe *pipe, ms_scan_stat *stat)
+{
+	gint64 start;
+	GPtrArray *batch;
+
+	g_mutex_lock(pipe->mutex);
+	start = g_get_monotonic_time();
+	while ((batch = g_queue_pop_head(pipe->batches)) == NULL && pipe->producers > 0)
+		g_cond_wait(pipe->not_empty, pipe->mutex);
+	stat->wait_time += g_get_monotonic_time() - start;
+	if (batch != NULL)
+		g_cond_signal(pipe->not_full);
+	g_mutex_unlock(pipe->mutex);
+
+	return batch;
+}
 
-	if (first_scan_node == NULL) {
-		first_scan_node = current_dir;
-	} else {
-		/*if next node of current node is NULL, it is the lastest node. */
-		prv_node->next = current_dir;
+static void _ms_scan_pipe_close(ms_scan_pipe *pipe)
+{
+	g_mutex_lock(pipe->mutex);
+	pipe->producers--;
+	if (pipe->producers == 0)
+		g_cond_broadcast(pipe->not_empty);
+	g_mutex_unlock(pipe->mutex);
+}
+
+static int _ms_scan_push_dir(ms_scan_worker *worker, const char *path)
+{
+	char *dir;
+	ms_scan_job *job = worker->job;
+
+	dir = strdup(path);
+	if (dir == NULL) {
+		MS_DBG_ERR("strdup fail");
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
 	}
-	MS_DBG("scan path : %s", full_path);
+
+	g_mutex_lock(worker->mutex);
+	g_queue_push_tail(worker->dirs, dir);
+	g_mutex_unlock(worker->mutex);
+
+	g_mutex_lock(job->mutex);
+	job->queued++;
+	job->pending++;
+	if (job->idle > 0)
+		g_cond_signal(job->cond);
+	g_mutex_unlock(job->mutex);
 
 	return MS_ERR_NONE;
 }
 
-static void _ms_dir_check(ms_scan_data_t * scan_data)
+static char *_ms_scan_take_dir(ms_scan_worker *worker)
 {
-	int err = 0;
-	int depth = 0;
-	int find_folder = 0;
-	char get_path[MS_FILE_PATH_LEN_MAX] = { 0 };
-	char *path = NULL;
-	DIR *dp = NULL;
-	struct dirent entry;
-	struct dirent *result;
-	ms_storage_type_t storage_type = scan_data->storage_type;
-
-	ms_dir_scan_info *root;
-	ms_dir_scan_info *tmp_root = NULL;
-	ms_dir_scan_info *cur_node = NULL; /*current node*/
-	ms_dir_scan_info *prv_node = NULL; /*previous node*/
-	ms_dir_scan_info *next_node = NULL;
-
-	root = malloc(sizeof(ms_dir_scan_info));
-	if (root == NULL) {
-		MS_DBG_ERR("malloc fail");
+	int i;
+	char *dir;
+	ms_scan_job *job = worker->job;
+	ms_scan_worker *victim;
+
+	/*newest directory of own queue is near the last one, it is still in cache*/
+	g_mutex_lock(worker->mutex);
+	dir = g_queue_pop_tail(worker->dirs);
+	g_mutex_unlock(worker->mutex);
+
+	/*oldest directory of others is near the root, it has the largest sub tree*/
+	for (i = 1; dir == NULL && i < job->worker_count; i++) {
+		victim = &job->workers[(worker->index + i) % job->worker_count];
+
+		g_mutex_lock(victim->mutex);
+		dir = g_queue_pop_head(victim->dirs);
+		g_mutex_unlock(victim->mutex);
+
+		if (dir != NULL)
+			worker->steal_count++;
+	}
+
+	if (dir != NULL) {
+		g_mutex_lock(job->mutex);
+		job->queued--;
+		g_mutex_unlock(job->mutex);
+	}
+
+	return dir;
+}
+
+static void _ms_scan_done_dir(ms_scan_worker *worker)
+{
+	ms_scan_job *job = worker->job;
+
+	g_mutex_lock(job->mutex);
+	job->pending--;
+	if (job->pending == 0)
+		g_cond_broadcast(job->cond);
+	g_mutex_unlock(job->mutex);
+}
+
+static ms_walk_result_t _ms_scan_queue_sub_dir(const char *path, void *user_data)
+{
+	ms_scan_worker *worker = user_data;
+
+	if (_ms_scan_push_dir(worker, path) != MS_ERR_NONE)
+		return MS_WALK_STOP;
+
+	return MS_WALK_CONTINUE;
+}
+
+static void _ms_scan_flush_files(ms_scan_worker *worker)
+{
+	ms_scan_job *job = worker->job;
+
+	if (worker->files == NULL)
 		return;
+
+	/*files are just dropped after stop*/
+	if (job->stop)
+		_ms_scan_free_paths(worker->files);
+	else
+		_ms_scan_pipe_push(&job->classify_pipe, worker->files, &worker->stat);
+
+	worker->files = NULL;
+}
+
+static int _ms_scan_add_file(ms_scan_worker *worker, const char *path)
+{
+	char *file;
+
+	if (worker->files == NULL) {
+		worker->files = g_ptr_array_sized_new(MS_SCAN_BATCH_SIZE);
+		if (worker->files == NULL) {
+			MS_DBG_ERR("g_ptr_array_sized_new fail");
+			return MS_ERR_ALLOCATE_MEMORY_FAIL;
+		}
 	}
 
-	root->name = strdup(scan_data->path);
-	if (root->name == NULL) {
+	file = strdup(path);
+	if (file == NULL) {
 		MS_DBG_ERR("strdup fail");
-		MS_SAFE_FREE(root);
-		return;
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
 	}
 
-	root->parent = NULL;
-	root->Rbrother = NULL;
-	root->next = NULL;
-	tmp_root = root;
-	prv_node = root;
+	g_ptr_array_add(worker->files, file);
+	worker->stat.file_count++;
 
-	path = malloc(sizeof(char) * MS_FILE_PATH_LEN_MAX);
+	if (worker->files->len >= MS_SCAN_BATCH_SIZE)
+		_ms_scan_flush_files(worker);
 
-	err = ms_get_full_path_from_node(tmp_root, path, depth);
-	if (err != MS_ERR_NONE) {
-		return;
+	return MS_ERR_NONE;
+}
+
+static ms_walk_result_t _ms_scan_file(ms_walk_batch *batch, void *user_data)
+{
+	int i;
+	const char *path;
+	ms_scan_worker *worker = user_data;
+	ms_scan_job *job = worker->job;
+
+	for (i = 0; i < batch->count; i++) {
+		if (job->stop)
+			return MS_WALK_STOP;
+
+		if (!(batch->entries[i].type & DT_REG))
+			continue;
+
+		path = ms_walk_entry_path(batch, i);
+		if (path == NULL)
+			continue;
+
+		if (_ms_scan_add_file(worker, path) != MS_ERR_NONE)
+			return MS_WALK_STOP;
 	}
 
-	_ms_scan_add_node(root, depth);
+	return MS_WALK_CONTINUE;
+}
+
+static void _ms_scan_read_dir(ms_scan_worker *worker, const char *path)
+{
+	int err;
+	gint64 start;
+	gint64 wait_time;
+
+	MS_DBG("[%d] scan path : %s", worker->index, path);
+
+	start = g_get_monotonic_time();
+	wait_time = worker->stat.wait_time;
+
+	/*watch is added before reading, no change of the directory is missed*/
+	if (!ms_inoti_is_watched(path))
+		ms_inoti_add_watch((char *)path);
+
+	/*events from now on are applied by inotify, scan can see the same file again*/
+	ms_inoti_set_scan_done(path);
+
+	err = ms_read_dir(path, _ms_scan_queue_sub_dir, _ms_scan_file, worker);
+	if (err != MS_ERR_NONE)
+		MS_DBG_ERR("ms_read_dir error : %d", err);
+
+	worker->dir_count++;
+	worker->stat.busy_time += g_get_monotonic_time() - start - (worker->stat.wait_time - wait_time);
+}
+
+static void _ms_scan_run_worker(ms_scan_worker *worker)
+{
+	char *dir;
+	ms_scan_job *job = worker->job;
 
 	while (1) {
-		/*check poweroff status*/
-		if (power_off) {
-			MS_DBG("Power off");
-			goto FREE_RESOURCES;
+		dir = _ms_scan_take_dir(worker);
+		if (dir == NULL) {
+			/*files are not held while this worker waits*/
+			_ms_scan_flush_files(worker);
+
+			g_mutex_lock(job->mutex);
+			if (job->pending == 0) {
+				g_mutex_unlock(job->mutex);
+				break;
+			}
+			/*directories being read by others may have sub directories*/
+			if (job->queued == 0) {
+				job->idle++;
+				g_cond_wait(job->cond, job->mutex);
+				job->idle--;
+			}
+			g_mutex_unlock(job->mutex);
+			continue;
 		}
 
-		/*check SD card in out*/
-		if ((mmc_state != VCONFKEY_SYSMAN_MMC_MOUNTED) && (storage_type == MS_STORATE_EXTERNAL))
-			goto FREE_RESOURCES;
+		if (!job->stop && _ms_scan_stopped(job->storage_type))
+			job->stop = true;
 
-		depth ++;
-		dp = opendir(path);
-		if (dp == NULL) {
-			MS_DBG_ERR("%s folder opendir fails", path);
-			goto NEXT_DIR;
-		}
+		/*queued directories are just dropped after stop*/
+		if (!job->stop)
+			_ms_scan_read_dir(worker, dir);
 
-		while (!readdir_r(dp, &entry, &result)) {
-			/*check poweroff status*/
-			if (power_off) {
-				MS_DBG("Power off");
-				goto FREE_RESOURCES;
-			}
+		MS_SAFE_FREE(dir);
+		_ms_scan_done_dir(worker);
+	}
 
-			if (result == NULL)
-				break;
+	MS_DBG("[%d] dir : %d, file : %d, steal : %d",
+		worker->index, worker->dir_count, worker->stat.file_count, worker->steal_count);
+}
 
-			if (entry.d_name[0] == '.')
-				continue;
+static gpointer _ms_scan_enumerate_thread(gpointer data)
+{
+	ms_scan_worker *worker = data;
 
-			/*check SD card in out*/
-			if ((mmc_state != VCONFKEY_SYSMAN_MMC_MOUNTED) && (storage_type == MS_STORATE_EXTERNAL)) {
-				goto FREE_RESOURCES;
-			}
+	_ms_scan_run_worker(worker);
 
-			if (entry.d_type & DT_DIR) {
-				DIR *tmp_dp = NULL;
-				err = ms_strappend(get_path, sizeof(get_path), "%s/%s",path, entry.d_name);
-				if (err != MS_ERR_NONE) {
-					MS_DBG_ERR("ms_strappend error");
-					continue;
-				}
-
-				tmp_dp = opendir(get_path);
-				if (tmp_dp == NULL) {
-					MS_DBG_ERR("%s folder opendir fails", get_path);
-					continue;
-				}
-				else
-					closedir(tmp_dp);
-
-				cur_node = malloc(sizeof(ms_dir_scan_info));
-				if (cur_node == NULL) {
-					MS_DBG_ERR("malloc fail");
-
-					goto FREE_RESOURCES;
-				}
-
-				cur_node->name = strdup(entry.d_name);
-				cur_node->Rbrother = NULL;
-				cur_node->next = NULL;
-
-				/*1. 1st folder */
-				if (find_folder == 0) {
-					cur_node->parent = tmp_root;
-					tmp_root = cur_node;
-				} else {
-					cur_node->parent = tmp_root->parent;
-					prv_node->Rbrother = cur_node;
-				}
-				prv_node->next = cur_node;
-
-				/*add watch */
-				_ms_scan_add_node(cur_node, depth);
-
-				/*change previous */
-				prv_node = cur_node;
-				find_folder++;
-			}
+	_ms_scan_pipe_close(&worker->job->classify_pipe);
+
+	return NULL;
+}
+
+static GPtrArray *_ms_scan_classify(ms_scan_classifier *classifier, GPtrArray *paths)
+{
+	int err;
+	guint i;
+	char *path;
+	GPtrArray *items;
+	ms_scan_item *item;
+	ms_scan_job *job = classifier->job;
+
+	items = g_ptr_array_sized_new(paths->len);
+	if (items == NULL) {
+		MS_DBG_ERR("g_ptr_array_sized_new fail");
+		_ms_scan_free_paths(paths);
+		return NULL;
+	}
+
+	for (i = 0; i < paths->len; i++) {
+		path = g_ptr_array_index(paths, i);
+
+		/*files are just dropped after stop*/
+		if (job->stop) {
+			MS_SAFE_FREE(path);
+			continue;
 		}
-NEXT_DIR:
-		MS_SAFE_FREE(path);
-		if (dp) closedir(dp);
-		dp = NULL;
 
-		err = _ms_scan_get_next_path_from_current_node(find_folder, &tmp_root, &root, &path, &depth);
-		if (err != MS_ERR_NONE)
-			break;
+		item = calloc(1, sizeof(ms_scan_item));
+		if (item == NULL) {
+			MS_DBG_ERR("calloc fail");
+			MS_SAFE_FREE(path);
+			continue;
+		}
 
-		if (tmp_root == NULL)
-			break;
+		err = ms_get_item_mime(path, item->mimetype, &item->drm);
+		if (err != MS_ERR_NONE) {
+			MS_DBG_ERR("err : ms_get_item_mime [%d] %s", err, path);
+			MS_SAFE_FREE(path);
+			MS_SAFE_FREE(item);
+			continue;
+		}
 
-		find_folder = 0;
+		item->path = path;
+		g_ptr_array_add(items, item);
+		classifier->stat.file_count++;
 	}
+	g_ptr_array_free(paths, TRUE);
 
-FREE_RESOURCES:
-	/*free allocated memory */
-	MS_SAFE_FREE(path);
-	if (dp) closedir(dp);
-	dp = NULL;
-
-	cur_node = root;
-	while (cur_node != NULL) {
-		next_node = cur_node->next;
-		MS_SAFE_FREE(cur_node->name);
-		MS_SAFE_FREE(cur_node);
-		cur_node = next_node;
+	if (items->len == 0) {
+		g_ptr_array_free(items, TRUE);
+		return NULL;
 	}
+
+	return items;
 }
 
-void _ms_dir_scan(void **handle, ms_scan_data_t * scan_data)
+static gpointer _ms_scan_classify_thread(gpointer data)
 {
-	int err = 0;
-	char path[MS_FILE_PATH_LEN_MAX] = { 0 };
-	ms_scan_data *node;
-	DIR *dp = NULL;
-	ms_storage_type_t storage_type = scan_data->storage_type;
-	ms_dir_scan_type_t scan_type = scan_data->scan_type;
-
-	err = ms_strcopy(path, sizeof(path), "%s", scan_data->path);
-	if (err != MS_ERR_NONE) {
-		MS_DBG_ERR("error : %d", err );
+	gint64 start;
+	GPtrArray *paths;
+	GPtrArray *items;
+	ms_scan_classifier *classifier = data;
+	ms_scan_job *job = classifier->job;
+
+	/*pipe is drained even after stop, enumeration stage is never blocked*/
+	while ((paths = _ms_scan_pipe_pop(&job->classify_pipe, &classifier->stat)) != NULL) {
+		start = g_get_monotonic_time();
+		items = _ms_scan_classify(classifier, paths);
+		classifier->stat.busy_time += g_get_monotonic_time() - start;
+
+		if (items != NULL)
+			_ms_scan_pipe_push(&job->persist_pipe, items, &classifier->stat);
 	}
 
-	/*Add inotify watch */
-	if (scan_type != MS_SCAN_INVALID)
-		_ms_dir_check(scan_data);
+	_ms_scan_pipe_close(&job->persist_pipe);
 
-	/*if scan type is not MS_SCAN_NONE, check data in db. */
-	if (scan_type == MS_SCAN_ALL || scan_type == MS_SCAN_PART) {
-		struct dirent entry;
-		struct dirent *result = NULL;
+	return NULL;
+}
 
-		node = first_scan_node;
+/*persistence stage runs on the scan thread, it uses the handle and bundle of its caller*/
+static void _ms_scan_persist(void **handle, ms_scan_job *job, ms_scan_stat *stat)
+{
+	int err;
+	guint i;
+	gint64 start;
+	GPtrArray *items;
+	ms_scan_item *item;
+	int inserted = 0;
 
-		while (node != NULL) {
-			/*check poweroff status*/
-			if (power_off) {
-				MS_DBG("Power off");
-				goto STOP_SCAN;
-			}
+	while ((items = _ms_scan_pipe_pop(&job->persist_pipe, stat)) != NULL) {
+		start = g_get_monotonic_time();
 
-			/*check SD card in out */
-			if ((mmc_state != VCONFKEY_SYSMAN_MMC_MOUNTED) && (storage_type == MS_STORATE_EXTERNAL)) {
-			    	MS_DBG("Directory scanning is stopped");
-				goto STOP_SCAN;
-			}
+		for (i = 0; i < items->len && !job->stop; i++) {
+			item = g_ptr_array_index(items, i);
 
-			dp = opendir(node->name);
-			if (dp != NULL) {
-				while (!readdir_r(dp, &entry, &result)) {
-					/*check poweroff status*/
-					if (power_off) {
-						MS_DBG("Power off");
-						goto STOP_SCAN;
-					}
-
-					if (result == NULL)
-						break;
-
-					if (entry.d_name[0] == '.')
-						continue;
-
-					/*check SD card in out */
-					if ((mmc_state != VCONFKEY_SYSMAN_MMC_MOUNTED) && (storage_type == MS_STORATE_EXTERNAL)) {
-						MS_DBG("Directory scanning is stopped");
-						goto STOP_SCAN;
-					}
-
-					if (entry.d_type & DT_REG) {
-						err = ms_strappend(path, sizeof(path), "%s/%s", node->name, entry.d_name);
-						if (err < 0) {
-							MS_DBG_ERR("error : %d", err);
-							continue;
-						}
-
-						if (scan_type == MS_SCAN_PART)
-							err = ms_validate_item(handle,path);
-						else
-							err = ms_insert_item_batch(handle, path);
-
-						if (err < 0) {
-							MS_DBG_ERR("failed to update db : %d , %d\n", err, scan_type);
-							continue;
-						}
-					}
-				}
+			if (job->scan_type == MS_SCAN_PART) {
+				err = ms_validate_item_with_mime(handle, item->path, item->mimetype, item->drm);
 			} else {
-				MS_DBG_ERR("%s folder opendir fails", node->name);
+				err = ms_register_file_batch_with_mime(handle, item->path, item->mimetype, item->drm);
+				if (err == MS_ERR_NONE)
+					inserted++;
 			}
-			if (dp) closedir(dp);
-			dp = NULL;
 
-			if (node == NULL) {
-				MS_DBG_ERR("DB updating is done");
-				break;
+			/*file in work is inserted by the other request*/
+			if (err == MS_ERR_FILE_NOT_FOUND) {
+				MS_DBG("deleted while scanning : %s", item->path);
+			} else if (err < 0 && err != MS_ERR_NOW_REGISTER_FILE) {
+				MS_DBG_ERR("failed to update db : %d , %d", err, job->scan_type);
 			}
-			node = node->next;
-		}		/*db update while */
-	} else if ( scan_type == MS_SCAN_INVALID) {
+
+			stat->file_count++;
+		}
+		_ms_scan_free_items(items);
+
+		/*requests merged into inserted files run after commit*/
+		if (inserted >= MS_SCAN_COMMIT_COUNT) {
+			ms_register_end(handle);
+			ms_register_start(handle);
+			inserted = 0;
+		}
+
+		stat->busy_time += g_get_monotonic_time() - start;
+	}
+}
+
+static void _ms_scan_log_stat(const char *stage, int thread_count, ms_scan_stat *stat)
+{
+	int rate = 0;
+
+	/*files per second of the stage, busy time is summed over its threads*/
+	if (stat->busy_time > 0)
+		rate = (int)(stat->file_count * (gint64)1000000 * thread_count / stat->busy_time);
+
+	MS_DBG("%s [%d thread] file : %d, busy : %lld ms, wait : %lld ms, %d files/s",
+		stage, thread_count, stat->file_count,
+		(long long)(stat->busy_time / 1000), (long long)(stat->wait_time / 1000), rate);
+}
+
+static void _ms_scan_add_stat(ms_scan_stat *sum, ms_scan_stat *stat)
+{
+	sum->file_count += stat->file_count;
+	sum->busy_time += stat->busy_time;
+	sum->wait_time += stat->wait_time;
+}
+
+static void _ms_scan_free_job(ms_scan_job *job)
+{
+	int i;
+	char *dir;
+	ms_scan_worker *worker;
+
+	for (i = 0; i < job->worker_count; i++) {
+		worker = &job->workers[i];
+		if (worker->dirs != NULL) {
+			while ((dir = g_queue_pop_head(worker->dirs)) != NULL)
+				MS_SAFE_FREE(dir);
+			g_queue_free(worker->dirs);
+		}
+		if (worker->files != NULL)
+			_ms_scan_free_paths(worker->files);
+		if (worker->mutex != NULL)
+			g_mutex_free(worker->mutex);
+	}
+
+	_ms_scan_pipe_free(&job->classify_pipe, _ms_scan_free_paths);
+	_ms_scan_pipe_free(&job->persist_pipe, _ms_scan_free_items);
+
+	MS_SAFE_FREE(job->classifiers);
+	MS_SAFE_FREE(job->workers);
+	if (job->cond != NULL)
+		g_cond_free(job->cond);
+	if (job->mutex != NULL)
+		g_mutex_free(job->mutex);
+}
+
+static int _ms_scan_init_job(ms_scan_job *job, ms_scan_data_t *scan_data, int worker_count)
+{
+	int i;
+	int err;
+	ms_scan_worker *worker;
+
+	memset(job, 0, sizeof(ms_scan_job));
+	job->storage_type = scan_data->storage_type;
+	job->scan_type = scan_data->scan_type;
+
+	job->mutex = g_mutex_new();
+	job->cond = g_cond_new();
+	job->workers = calloc(worker_count, sizeof(ms_scan_worker));
+	job->classifiers = calloc(worker_count, sizeof(ms_scan_classifier));
+	if (job->mutex == NULL || job->cond == NULL || job->workers == NULL || job->classifiers == NULL) {
+		MS_DBG_ERR("scan job init fail");
+		return MS_ERR_ALLOCATE_MEMORY_FAIL;
+	}
+	job->worker_count = worker_count;
+
+	for (i = 0; i < worker_count; i++) {
+		worker = &job->workers[i];
+		worker->job = job;
+		worker->index = i;
+		worker->mutex = g_mutex_new();
+		worker->dirs = g_queue_new();
+		if (worker->mutex == NULL || worker->dirs == NULL) {
+			MS_DBG_ERR("scan job init fail");
+			return MS_ERR_ALLOCATE_MEMORY_FAIL;
+		}
+
+		job->classifiers[i].job = job;
+		job->classifiers[i].index = i;
+	}
+
+	/*each thread of the former stage closes the pipe once*/
+	err = _ms_scan_pipe_init(&job->classify_pipe, worker_count);
+	if (err != MS_ERR_NONE)
+		return err;
+
+	err = _ms_scan_pipe_init(&job->persist_pipe, worker_count);
+	if (err != MS_ERR_NONE)
+		return err;
+
+	return MS_ERR_NONE;
+}
+
+/*scan is a pipeline of 3 stages, enumeration reads directories, classification gets mime types, and persistence updates DB.
+each directory is read once : its watch is added, then its files are passed to the next stage and sub directories are queued*/
+void _ms_dir_scan(void **handle, ms_scan_data_t * scan_data)
+{
+	int i;
+	int err = 0;
+	int classifier_count = 0;
+	gint64 start;
+	ms_scan_job job;
+	ms_scan_stat enumerate_stat;
+	ms_scan_stat classify_stat;
+	ms_scan_stat persist_stat;
+
+	if (scan_data->scan_type == MS_SCAN_INVALID) {
 		/*In this case, update just validation record*/
 		/*update just valid type*/
-		err = ms_invalidate_all_items(handle, storage_type);
+		err = ms_invalidate_all_items(handle, scan_data->storage_type);
 		if (err != MS_ERR_NONE)
 			MS_DBG_ERR("error : %d", err);
+		return;
+	}
+
+	err = _ms_scan_init_job(&job, scan_data, _ms_scan_get_worker_count());
+	if (err != MS_ERR_NONE)
+		goto FREE_JOB;
+
+	MS_DBG("[%s] scan worker : %d", scan_data->path, job.worker_count);
+
+	start = g_get_monotonic_time();
+	memset(&enumerate_stat, 0, sizeof(ms_scan_stat));
+	memset(&classify_stat, 0, sizeof(ms_scan_stat));
+	memset(&persist_stat, 0, sizeof(ms_scan_stat));
+
+	err = _ms_scan_push_dir(&job.workers[0], scan_data->path);
+	if (err != MS_ERR_NONE)
+		goto FREE_JOB;
+
+	for (i = 0; i < job.worker_count; i++) {
+		job.classifiers[i].thread = g_thread_create((GThreadFunc)_ms_scan_classify_thread, &job.classifiers[i], TRUE, NULL);
+		if (job.classifiers[i].thread == NULL) {
+			MS_DBG_ERR("[%d] g_thread_create failed", i);
+			_ms_scan_pipe_close(&job.persist_pipe);
+		} else {
+			classifier_count++;
+		}
 	}
-STOP_SCAN:
-	if (dp) closedir(dp);
 
-	/*delete all node*/
-	node = first_scan_node;
+	/*nothing takes enumerated files*/
+	if (classifier_count == 0)
+		job.stop = true;
+
+	for (i = 0; i < job.worker_count; i++) {
+		if (!job.stop)
+			job.workers[i].thread = g_thread_create((GThreadFunc)_ms_scan_enumerate_thread, &job.workers[i], TRUE, NULL);
+		if (job.workers[i].thread == NULL) {
+			/*directories of this worker are stolen by others*/
+			MS_DBG_ERR("[%d] enumeration is not started", i);
+			_ms_scan_pipe_close(&job.classify_pipe);
+		}
+	}
+
+	_ms_scan_persist(handle, &job, &persist_stat);
+
+	for (i = 0; i < job.worker_count; i++) {
+		if (job.workers[i].thread != NULL)
+			g_thread_join(job.workers[i].thread);
+		if (job.classifiers[i].thread != NULL)
+			g_thread_join(job.classifiers[i].thread);
 
-	while (node != NULL) {
-		if (node->name) free(node->name);
-		MS_SAFE_FREE(node);
+		_ms_scan_add_stat(&enumerate_stat, &job.workers[i].stat);
+		_ms_scan_add_stat(&classify_stat, &job.classifiers[i].stat);
 	}
 
-	first_scan_node = NULL;
+	_ms_scan_log_stat("enumerate", job.worker_count, &enumerate_stat);
+	_ms_scan_log_stat("classify", classifier_count, &classify_stat);
+	_ms_scan_log_stat("persist", 1, &persist_stat);
+	MS_DBG("scan time : %lld ms", (long long)((g_get_monotonic_time() - start) / 1000));
+
+	if (!job.stop)
+		MS_DBG("DB updating is done");
+
+FREE_JOB:
+	_ms_scan_free_job(&job);
 
 	sync();
 
 	return;
 }
+
+typedef struct ms_rescan_walk_data {
+	void **handle;
+	ms_storage_type_t storage_type;
+	time_t since;
+	bool entered;	/*directory of request is entered*/
+} ms_rescan_walk_data;
+
+static ms_walk_result_t _ms_rescan_enter_dir(const char *path, void *user_data)
+{
+	ms_rescan_walk_data *data = user_data;
+
+	if (_ms_scan_stopped(data->storage_type))
+		return MS_WALK_STOP;
+
+	if (!data->entered) {
+		data->entered = true;
+		return MS_WALK_CONTINUE;
+	}
+
+	/*watched directory has its own events, only new directory is scanned*/
+	if (ms_inoti_is_watched(path))
+		return MS_WALK_SKIP;
+
+	ms_inoti_add_watch((char *)path);
+
+	return MS_WALK_CONTINUE;
+}
+
+static ms_walk_result_t _ms_rescan_file(ms_walk_batch *batch, void *user_data)
+{
+	int i;
+	int err;
+	const char *path;
+	struct stat st;
+	ms_rescan_walk_data *data = user_data;
+
+	for (i = 0; i < batch->count; i++) {
+		if (_ms_scan_stopped(data->storage_type))
+			return MS_WALK_STOP;
+
+		if (!(batch->entries[i].type & DT_REG))
+			continue;
+
+		path = ms_walk_entry_path(batch, i);
+		if (path == NULL)
+			continue;
+
+		if (ms_check_exist(data->handle, path) == MS_ERR_NONE) {
+			/*events of this file may be lost*/
+			if (fstatat(batch->dir_fd, batch->entries[i].name, &st, 0) == 0 && st.st_mtime >= data->since) {
+				err = ms_refresh_item(data->handle, path);
+				if (err != MS_ERR_NONE)
+					MS_DBG_ERR("ms_refresh_item error : %d", err);
+			}
+		}
+
+		/*insert new file, or set validity of existing file*/
+		err = ms_validate_item(data->handle, (char *)path);
+		if (err < 0)
+			MS_DBG_ERR("failed to update db : %d", err);
+	}
+
+	return MS_WALK_CONTINUE;
+}
+
+void _ms_dir_rescan(void **handle, ms_scan_data_t * scan_data)
+{
+	int err;
+	ms_rescan_walk_data data;
+
+	/*items which are not found in the directory are deleted after rescan*/
+	if (ms_support_folder_validity())
+		ms_invalidate_folder_items(handle, scan_data->path);
+
+	if (!ms_inoti_is_watched(scan_data->path))
+		ms_inoti_add_watch(scan_data->path);
+
+	data.handle = handle;
+	data.storage_type = scan_data->storage_type;
+	data.since = scan_data->since;
+	data.entered = false;
+
+	err = ms_walk_dir(scan_data->path, _ms_rescan_enter_dir, _ms_rescan_file, &data);
+	if (err != MS_ERR_NONE)
+		MS_DBG_ERR("ms_walk_dir error : %d", err);
+
+	sync();
+}
@@ -32,6 +32,7 @@
 #include "media-server-utils.h"
 #include "media-server-db-svc.h"
 #include "media-server-external-storage.h"
+#include "media-server-inotify.h"
 #include "media-server-scan-internal.h"
 #include "media-server-scan.h"
 
@@ -45,6 +46,12 @@ extern struct timeval g_mmc_start_time;
 extern struct timeval g_mmc_end_time;
 #endif
 
+static void _free_scan_data(ms_scan_data_t *data)
+{
+	MS_SAFE_FREE(data->path);
+	MS_SAFE_FREE(data);
+}
+
 static void _insert_array(GArray *garray, ms_scan_data_t *insert_data)
 {
 	ms_scan_data_t *data;
@@ -58,15 +65,49 @@ static void _insert_array(GArray *garray, ms_scan_data_t *insert_data)
 
 	if (insert_data->scan_type == POWEROFF) {
 		g_array_prepend_val(garray, insert_data);
-	} else {
+	} else if (insert_data->scan_type == MS_SCAN_DIRECTORY) {
+		/*directory rescan has the lowest priority, and is covered by storage scan*/
 		for (i=0; i < len; i++) {
 			data = g_array_index(garray, ms_scan_data_t*, i);
 
+			if (data->scan_type == MS_SCAN_DIRECTORY) {
+				if (strcmp(data->path, insert_data->path) == 0) {
+					if (data->since > insert_data->since)
+						data->since = insert_data->since;
+					insert_ok = true;
+					break;
+				}
+			} else if (data->scan_type != POWEROFF && data->scan_type != MS_SCAN_INVALID) {
+				if (data->storage_type == insert_data->storage_type) {
+					insert_ok = true;
+					break;
+				}
+			}
+		}
+
+		if (insert_ok == false)
+			g_array_append_val(garray, insert_data);
+		else
+			_free_scan_data(insert_data);
+	} else {
+		for (i = len - 1; i >= 0; i--) {
+			data = g_array_index(garray, ms_scan_data_t*, i);
+
 			if (data->scan_type != POWEROFF) {
 				if (data->storage_type == insert_data->storage_type) {
-					if(data->scan_type > insert_data->scan_type) {
+					if (data->scan_type == MS_SCAN_DIRECTORY) {
+						/*storage scan covers directory rescan*/
+						g_array_remove_index (garray, i);
+						_free_scan_data(data);
+					} else if (insert_ok == false && data->scan_type == insert_data->scan_type) {
+						/*same scan of storage is waiting already*/
+						insert_ok = true;
+						_free_scan_data(insert_data);
+						insert_data = data;
+					} else if(insert_ok == false && data->scan_type > insert_data->scan_type) {
 						g_array_remove_index (garray, i);
 						g_array_insert_val(garray, i, insert_data);
+						_free_scan_data(data);
 						insert_ok =  true;
 					}
 				}
@@ -78,6 +119,32 @@ static void _insert_array(GArray *garray, ms_scan_data_t *insert_data)
 	}
 }
 
+void ms_scan_request(const char *path, ms_dir_scan_type_t scan_type, time_t since)
+{
+	ms_scan_data_t *scan_data;
+
+	scan_data = malloc(sizeof(ms_scan_data_t));
+	if (scan_data == NULL) {
+		MS_DBG_ERR("malloc fail");
+		return;
+	}
+
+	scan_data->path = strdup(path);
+	if (scan_data->path == NULL) {
+		MS_DBG_ERR("strdup fail");
+		MS_SAFE_FREE(scan_data);
+		return;
+	}
+
+	scan_data->storage_type = ms_get_storage_type_by_full(path);
+	scan_data->scan_type = scan_type;
+	scan_data->since = since;
+
+	MS_DBG("request scan : %s [%d]", path, scan_type);
+
+	g_async_queue_push(scan_queue, GINT_TO_POINTER(scan_data));
+}
+
 gboolean ms_scan_thread(void *data)
 {
 	ms_scan_data_t *scan_data = NULL;
@@ -145,13 +212,22 @@ gboolean ms_scan_thread(void *data)
 #endif
 		/*call for bundle commit*/
 		ms_register_start(handle);
-		if (scan_type == MS_SCAN_PART) {
+		if (scan_type == MS_SCAN_PART || scan_type == MS_SCAN_DIRECTORY) {
 			/*enable bundle commit*/
 			ms_validate_start(handle);
 		}
 
 		/*add inotify watch and insert data into media db */
-		_ms_dir_scan(handle, scan_data);
+		if (scan_type == MS_SCAN_DIRECTORY) {
+			_ms_dir_rescan(handle, scan_data);
+		} else {
+			if (scan_type == MS_SCAN_ALL || scan_type == MS_SCAN_PART)
+				ms_inoti_begin_scan(storage_type);
+
+			_ms_dir_scan(handle, scan_data);
+
+			ms_inoti_end_scan(storage_type);
+		}
 
 		if (power_off) {
 			MS_DBG("power off");
@@ -164,6 +240,11 @@ gboolean ms_scan_thread(void *data)
 			/*disable bundle commit*/
 			ms_validate_end(handle);
 			ms_delete_invalid_items(handle, storage_type);
+		} else if (scan_type == MS_SCAN_DIRECTORY) {
+			/*disable bundle commit*/
+			ms_validate_end(handle);
+			if (ms_support_folder_validity())
+				ms_delete_invalid_folder_items(handle, scan_data->path);
 		}
 
 #ifdef FMS_PERF
@@ -38,7 +38,6 @@
 
 #define MS_REGISTER_PORT 1001
 
-GAsyncQueue* ret_queue;
 
 gboolean ms_read_socket(GIOChannel *src,
 									GIOCondition condition,
@@ -68,10 +67,8 @@ gboolean ms_read_socket(GIOChannel *src,
 		MS_DBG_ERR("recvfrom failed");
 		return TRUE;
 	}
-	ret = ms_register_file(handle, recv_buff, ret_queue);
-	if (ret == MS_ERR_NOW_REGISTER_FILE) {
-		ret= GPOINTER_TO_INT(g_async_queue_pop(ret_queue)) - MS_ERR_MAX;
-	}
+	/*reply after the file is in DB, even if other work registers it*/
+	ret = ms_register_file(handle, recv_buff, true);
 
 	if (ret != MS_ERR_NONE) {
 		MS_DBG_ERR("ms_register_file error : %d", ret);
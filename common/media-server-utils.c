@@ -137,58 +137,6 @@ ms_is_mmc_inserted(void)
 	}
 }
 
-/*CAUTION : Before using this function, Have to allocate static memory of ret_path*/
-/*And the array length does not over MS_FILE_PATH_LEN_MAX*/
-/*for example : char path[MS_FILE_PATH_LEN_MAX] = {0};*/
-int
-ms_get_full_path_from_node(ms_dir_scan_info * const node, char *ret_path, int depth)
-{
-	int i = 0;
-	int path_length = 0;
-	int length = 0;
-	ms_dir_scan_info *cur_node;
-	char **path_array;
-
-	if (depth < 0) {
-		MS_DBG_ERR("depth < 0");
-		return MS_ERR_INVALID_DIR_PATH;
-	}
-
-	path_array = malloc(sizeof(char*) * (depth + 1));
-
-	cur_node = node;
-
-	while (1) {
-		path_array[i] = cur_node->name;
-		if (cur_node->parent == NULL)
-			break;
-
-		cur_node = cur_node->parent;
-		i++;
-	}
-
-	for(i = depth ; i >= 0 ; i --) {
-		length = strlen(path_array[i]);
-
-		if (path_length + length > MS_FILE_PATH_LEN_MAX) {
-			MS_DBG_ERR("This is invalid path, %s, %d", node->name, depth);
-			return MS_ERR_INVALID_DIR_PATH;
-		}
-
-		strncpy(ret_path+path_length, path_array[i], length);
-		path_length += length;
-
-		ret_path[path_length] = '/';
-		path_length ++;
-	}
-
-	ret_path[-- path_length] = '\0';
-
-	free(path_array);
-
-	return MS_ERR_NONE;
-}
-
 ms_storage_type_t
 ms_get_storage_type_by_full(const char *path)
 {
@@ -56,6 +56,11 @@ vconftool set -t int db/filemanager/dbupdate "1"
 vconftool set -t int memory/filemanager/Mmc "0" -i
 
 vconftool set -t string db/private/mediaserver/mmc_info ""
+vconftool set -t int db/private/mediaserver/coalesce_time "200"
+vconftool set -t int db/private/mediaserver/inotify_shard "0"
+vconftool set -t int db/private/mediaserver/tombstone_time "2000"
+vconftool set -t int db/private/mediaserver/scan_worker "0"
+vconftool set -t int db/private/mediaserver/fanotify "0"
 
 
 %files